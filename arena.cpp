@@ -0,0 +1,113 @@
+#include "arena.h"
+#include <new>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+const size_t Arena::defaultBlockSize;
+
+Arena::Arena(size_t _blockSize) :blockSize(_blockSize), currentBlock(0), offset(0), bytesUsed(0), bytesReserved(0), allocationCount(0), blockCount(0) {
+}
+
+void * Arena::allocate(size_t bytes, size_t alignment) {
+
+	allocationCount++;
+
+	while (true) {
+
+		if (currentBlock < blocks.size()) {
+
+			auto & block = blocks[currentBlock];
+			size_t start = (offset + alignment - 1) & ~(alignment - 1);
+
+			if (start + bytes <= block.size) {
+				bytesUsed += start + bytes - offset;
+				offset = start + bytes;
+				return block.data + start;
+			}
+
+		}
+
+		//Need a fresh block. Oversized requests (e.g. hash bucket arrays) get a block of their own.
+		Block block;
+		block.size = std::max(blockSize, bytes + alignment);
+		block.data = (char *)malloc(block.size);
+		if (block.data == nullptr)
+			throw std::bad_alloc();
+
+		bytesReserved += block.size;
+		blockCount++;
+
+		blocks.push_back(block);
+		currentBlock = blocks.size() - 1;
+		offset = 0;
+
+	}
+
+}
+
+void Arena::reset() {
+
+	for (auto & i : blocks)
+		free(i.data);
+
+	blocks.clear();
+	currentBlock = 0;
+	offset = 0;
+	bytesUsed = 0;
+	bytesReserved = 0;
+
+}
+
+void Arena::setBlockSize(size_t bytes) {
+	blockSize = bytes;
+}
+
+size_t Arena::getBytesUsed() {
+	return bytesUsed;
+}
+
+size_t Arena::getBytesReserved() {
+	return bytesReserved;
+}
+
+size_t Arena::getAllocationCount() {
+	return allocationCount;
+}
+
+size_t Arena::getBlockCount() {
+	return blockCount;
+}
+
+double Arena::getSystemAllocationTime(size_t bytes) {
+
+	const size_t batch = 64 * 1024;
+	vector<void *> held(batch);
+	double seconds = 0;
+
+	//The first round pays for faulting in fresh heap pages, only the second one is kept
+	for (int round = 0; round < 2; round++) {
+
+		auto start = chrono::steady_clock::now();
+
+		for (auto & i : held)
+			if ((i = malloc(bytes)) == nullptr)
+				throw std::bad_alloc();
+
+		for (auto & i : held)
+			free(i);
+
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	}
+
+	return seconds / batch;
+
+}
+
+Arena::~Arena() {
+	for (auto & i : blocks)
+		free(i.data);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+//Monotonic memory arena. Allocations are carved out of large blocks and never freed one by one;
+//reset() releases everything at once. This suits the counter tables, which grow until they're
+//flushed and are then thrown away wholesale.
+class Arena {
+
+public:
+
+	static const size_t defaultBlockSize = 16 * 1024 * 1024;
+
+	Arena(size_t _blockSize = defaultBlockSize);
+
+	void * allocate(size_t bytes, size_t alignment);
+
+	//Forget every allocation and hand the blocks back to the system, so a table that was flushed
+	//doesn't keep its peak reservation. Memory handed out before is invalid afterwards.
+	void reset();
+
+	//Size of the blocks allocated from now on
+	void setBlockSize(size_t bytes);
+
+	size_t getBytesUsed();
+	size_t getBytesReserved(); //what the arena holds from the system, the figure to budget for
+	size_t getAllocationCount(); //allocations served since construction
+	size_t getBlockCount();      //allocations requested from the system since construction
+
+	//Seconds a malloc and free of bytes take here, timed over a batch. The arena's allocations
+	//times this estimates what it saved over the system allocator.
+	static double getSystemAllocationTime(size_t bytes);
+
+	~Arena();
+
+private:
+
+	Arena(const Arena &);
+	Arena & operator = (const Arena &);
+
+	struct Block {
+		char * data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t blockSize;
+	size_t currentBlock;
+	size_t offset;
+	size_t bytesUsed;
+	size_t bytesReserved;
+	size_t allocationCount;
+	size_t blockCount;
+
+};
+
+//Standard allocator handing out memory from an Arena. deallocate is a no-op, the arena is reset instead.
+//The allocator travels with the container on swap so a table and its arena stay paired.
+template <class T> class ArenaAllocator {
+
+public:
+
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	ArenaAllocator(Arena * _arena) :arena(_arena) {};
+	template <class U> ArenaAllocator(const ArenaAllocator<U> & other) :arena(other.getArena()) {};
+
+	T * allocate(size_t n) {
+		return (T *)arena->allocate(n * sizeof(T), alignof(T));
+	};
+
+	void deallocate(T *, size_t) {};
+
+	Arena * getArena() const { return arena; };
+
+	template <class U> bool operator == (const ArenaAllocator<U> & rhs) const { return arena == rhs.getArena(); };
+	template <class U> bool operator != (const ArenaAllocator<U> & rhs) const { return arena != rhs.getArena(); };
+
+private:
+
+	Arena * arena;
+
+};
@@ -0,0 +1,107 @@
+#include "backgroundFlusher.h"
+#include <chrono>
+
+using namespace std;
+
+BackgroundFlusher::BackgroundFlusher() :busy(false), stopping(false), flushTime(0), stallTime(0), flushCount(0), worker(&BackgroundFlusher::run, this) {
+}
+
+KmerError BackgroundFlusher::submit(FlushJob _job) {
+
+	auto err = wait();
+	if (err.isError()) return err;
+
+	unique_lock<std::mutex> lock(mutex);
+	job = _job;
+	busy = true;
+	lock.unlock();
+
+	jobReady.notify_one();
+
+	return KmerError();
+
+}
+
+KmerError BackgroundFlusher::wait() {
+
+	unique_lock<std::mutex> lock(mutex);
+
+	if (busy) {
+		auto start = chrono::steady_clock::now();
+		jobDone.wait(lock, [this] { return !busy; });
+		stallTime += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	KmerError err = flushError;
+	flushError = KmerError();
+
+	return err;
+
+}
+
+double BackgroundFlusher::getFlushTime() {
+	lock_guard<std::mutex> lock(mutex);
+	return flushTime;
+}
+
+double BackgroundFlusher::getStallTime() {
+	lock_guard<std::mutex> lock(mutex);
+	return stallTime;
+}
+
+size_t BackgroundFlusher::getFlushCount() {
+	lock_guard<std::mutex> lock(mutex);
+	return flushCount;
+}
+
+void BackgroundFlusher::run() {
+
+	unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+
+		jobReady.wait(lock, [this] { return busy || stopping; });
+
+		if (!busy) return; //stopping and nothing left to do
+
+		FlushJob thisJob = job;
+		lock.unlock();
+
+		auto start = chrono::steady_clock::now();
+
+		KmerError err;
+		try {
+			err = thisJob();
+		}
+		catch (KmerError & e) {
+			err = e;
+		}
+		catch (std::exception & e) {
+			err = KmerError(e);
+		}
+
+		double duration = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		lock.lock();
+		flushError |= err;
+		flushTime += duration;
+		flushCount++;
+		job = FlushJob();
+		busy = false;
+		jobDone.notify_all();
+
+	}
+
+}
+
+BackgroundFlusher::~BackgroundFlusher() {
+
+	unique_lock<std::mutex> lock(mutex);
+	jobDone.wait(lock, [this] { return !busy; });
+	stopping = true;
+	lock.unlock();
+
+	jobReady.notify_one();
+	worker.join();
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "kmerError.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//Disk I/O thread for the KmerCounters. A counter that fills up its table swaps in a fresh one
+//and hands the full table to the flusher, so parsing and counting continue while the previous
+//table is being pushed into the database. Only one flush can be in flight at a time. Waiting on
+//the flusher before the next swap provides back-pressure, so at most two tables are ever alive.
+class BackgroundFlusher {
+
+public:
+
+	typedef std::function<KmerError()> FlushJob;
+
+	BackgroundFlusher();
+
+	//Blocks until the previous flush has finished, then queues the job
+	KmerError submit(FlushJob job);
+
+	//Blocks until the flusher is idle. Returns (and clears) any error raised by a background flush.
+	KmerError wait();
+
+	double getFlushTime();
+	double getStallTime();
+	size_t getFlushCount();
+
+	~BackgroundFlusher();
+
+private:
+
+	void run();
+
+	std::mutex mutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+
+	FlushJob job;
+	bool busy;
+	bool stopping;
+	KmerError flushError;
+
+	double flushTime; //time spent by the flusher thread writing to the database
+	double stallTime; //time the counting thread spent blocked on the flusher
+	size_t flushCount;
+
+	std::thread worker; //declared last so everything above is initialized before the thread starts
+
+};
@@ -0,0 +1,162 @@
+#include "checkpoint.h"
+#include <fstream>
+#include <limits>
+#include <sys/stat.h>
+#include <cstdio>
+
+using namespace std;
+
+static const char * checkpointMagic = "kmerCounter checkpoint 2";
+
+KmerError Checkpoint::describeInput(string path) {
+
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return KmerError(1, "Unable to stat input file " + path);
+
+	inputPath = path;
+	inputSize = info.st_size;
+	inputModified = info.st_mtime;
+
+	return KmerError();
+
+}
+
+KmerError Checkpoint::matches(const Checkpoint & current) const {
+
+	if (inputSize != current.inputSize || inputModified != current.inputModified)
+		return KmerError(1, "Checkpoint was taken for a different or modified input (" + inputPath + ")");
+
+	if (kmerWidth != current.kmerWidth)
+		return KmerError(1, "Checkpoint was taken for " + to_string(kmerWidth) + "-mers, not " + to_string(current.kmerWidth) + "-mers");
+
+	if (countBytes != current.countBytes)
+		return KmerError(1, "Checkpoint was taken with " + to_string(countBytes) + " byte counts, not " + to_string(current.countBytes));
+
+	if (minQuality != current.minQuality)
+		return KmerError(1, "Checkpoint was taken with --min-qual " + to_string(minQuality) + ", not " + to_string(current.minQuality));
+
+	if (sampleFraction != current.sampleFraction)
+		return KmerError(1, "Checkpoint was taken with --sample-fraction " + to_string(sampleFraction) + ", not " + to_string(current.sampleFraction));
+
+	if (maxReads != current.maxReads)
+		return KmerError(1, "Checkpoint was taken with --max-reads " + to_string(maxReads) + ", not " + to_string(current.maxReads));
+
+	if (dedupReads != current.dedupReads)
+		return KmerError(1, "Checkpoint was taken with --dedup " + to_string(dedupReads) + ", not " + to_string(current.dedupReads));
+
+	if (databasePath != current.databasePath)
+		return KmerError(1, "Checkpoint was taken counting into " + databasePath + ", not " + current.databasePath);
+
+	if (offset > inputSize)
+		return KmerError(1, "Checkpoint offset is past the end of the input");
+
+	return KmerError();
+
+}
+
+//One "name value" line per field. The paths come last, they're the only values that can hold spaces.
+KmerError Checkpoint::write(string path) const {
+
+	ofstream out(path.c_str(), ios_base::binary | ios_base::trunc);
+
+	out << checkpointMagic << "\n";
+	out << "generation " << generation << "\n";
+	out << "offset " << offset << "\n";
+	out << "reads " << reads << "\n";
+	out << "kmers " << kmers << "\n";
+	out << "kmerWidth " << kmerWidth << "\n";
+	out << "countBytes " << countBytes << "\n";
+	out << "minQuality " << minQuality << "\n";
+	out.precision(numeric_limits<double>::max_digits10);
+	out << "sampleFraction " << sampleFraction << "\n";
+	out << "maxReads " << maxReads << "\n";
+	out << "dedupReads " << dedupReads << "\n";
+	out << "inputSize " << inputSize << "\n";
+	out << "inputModified " << inputModified << "\n";
+	out << "input " << inputPath << "\n";
+	out << "database " << databasePath << "\n";
+
+	out.close();
+	if (out.fail())
+		return KmerError(1, "Unable to write checkpoint " + path);
+
+	return KmerError();
+
+}
+
+bool Checkpoint::exists(string path) {
+
+	struct stat info;
+	return stat(path.c_str(), &info) == 0;
+
+}
+
+KmerError Checkpoint::read(string path, Checkpoint & checkpoint) {
+
+	ifstream in(path.c_str(), ios_base::binary);
+	if (!in.is_open())
+		return KmerError(1, "Unable to open checkpoint " + path);
+
+	string line;
+	if (!getline(in, line) || line != checkpointMagic)
+		return KmerError(1, path + " is not a checkpoint");
+
+	checkpoint = Checkpoint();
+	size_t fields = 0;
+
+	try {
+
+		while (getline(in, line)) {
+
+			size_t space = line.find(' ');
+			if (space == string::npos)
+				continue;
+
+			string name = line.substr(0, space), value = line.substr(space + 1);
+			fields++;
+
+			if (name == "generation")
+				checkpoint.generation = stoul(value);
+			else if (name == "offset")
+				checkpoint.offset = stoull(value);
+			else if (name == "reads")
+				checkpoint.reads = stoull(value);
+			else if (name == "kmers")
+				checkpoint.kmers = stoull(value);
+			else if (name == "kmerWidth")
+				checkpoint.kmerWidth = stoull(value);
+			else if (name == "countBytes")
+				checkpoint.countBytes = stoull(value);
+			else if (name == "minQuality")
+				checkpoint.minQuality = stoul(value);
+			else if (name == "sampleFraction")
+				checkpoint.sampleFraction = stod(value);
+			else if (name == "maxReads")
+				checkpoint.maxReads = stoull(value);
+			else if (name == "dedupReads")
+				checkpoint.dedupReads = stoull(value);
+			else if (name == "inputSize")
+				checkpoint.inputSize = stoull(value);
+			else if (name == "inputModified")
+				checkpoint.inputModified = stoll(value);
+			else if (name == "input")
+				checkpoint.inputPath = value;
+			else if (name == "database")
+				checkpoint.databasePath = value;
+			else
+				fields--;
+
+		}
+
+	}
+	catch (std::exception & e) {
+		return KmerError(1, "Corrupt checkpoint " + path + " : " + e.what());
+	}
+
+	if (fields != 14)
+		return KmerError(1, "Incomplete checkpoint " + path);
+
+	return KmerError();
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "kmerError.h"
+#include <string>
+#include <cstdint>
+
+//Where a count stopped, saved with --checkpoint so --resume can carry on from there. The counts up to
+//offset are in the database, committed as generation (see BaseKeyCache::checkpoint). The input is
+//identified by its size and modification time, the database header covers k and precision again.
+//The options that decide which reads and bases are counted are recorded as well, so a resumed run
+//can't add counts taken another way to the same database.
+struct Checkpoint {
+
+	Checkpoint() :inputSize(0), inputModified(0), kmerWidth(0), countBytes(0), minQuality(0), sampleFraction(1), maxReads(0), dedupReads(0),
+		generation(0), offset(0), reads(0), kmers(0) {};
+
+	std::string inputPath;
+	uint64_t inputSize;
+	int64_t inputModified;
+	size_t kmerWidth;
+	size_t countBytes;
+	unsigned minQuality; //--min-qual
+	double sampleFraction; //--sample-fraction
+	uint64_t maxReads; //--max-reads
+	uint64_t dedupReads; //--dedup
+	std::string databasePath;
+	uint32_t generation;
+	uint64_t offset; //input bytes consumed, always at the start of a record
+	uint64_t reads;
+	uint64_t kmers;
+
+	//Fills in the input's size and modification time
+	KmerError describeInput(std::string path);
+
+	//Checks that the input and parameters are the ones the checkpoint was taken with
+	KmerError matches(const Checkpoint & current) const;
+
+	KmerError write(std::string path) const;
+	static KmerError read(std::string path, Checkpoint & checkpoint);
+	static bool exists(std::string path);
+
+	//A new checkpoint is written here first and renamed over the old one once the database committed it,
+	//so whichever of the two matches the database's generation is the one to resume from
+	static std::string getPendingPath(std::string path) { return path + ".pending"; };
+
+};
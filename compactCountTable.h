@@ -0,0 +1,169 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+//Open addressing count table for narrow counters. Keys and counts live in two flat arrays, so an entry
+//costs sizeof(K) + sizeof(V) bytes per slot and nothing else: no node, no pointers, no padding of the
+//count to the key's alignment. A 1 byte counter really costs 1 byte (per slot, at up to 3/4 load).
+//
+//A count of 0 marks an empty slot. operator[] hands out new entries at 0, so the caller has to count
+//at least 1 into them before the next lookup. Counters that saturate stay at their maximum, never 0.
+template <class K, typename V, class Hash> class CompactCountTable {
+
+public:
+
+	//What iterating yields in place of a map's value_type
+	struct Entry {
+		const K & first;
+		V & second;
+	};
+
+	class iterator {
+
+	public:
+
+		iterator(CompactCountTable * _table, size_t _slot) :table(_table), slot(_slot) {
+			skipEmpty();
+		};
+
+		Entry operator * () const { return Entry{ table->keys[slot], table->counts[slot] }; };
+
+		iterator & operator ++ () {
+			slot++;
+			skipEmpty();
+			return *this;
+		};
+
+		bool operator != (const iterator & rhs) const { return slot != rhs.slot; };
+
+	private:
+
+		void skipEmpty() {
+			while (slot < table->counts.size() && table->counts[slot] == 0)
+				slot++;
+		};
+
+		CompactCountTable * table;
+		size_t slot;
+
+	};
+
+	CompactCountTable() :entries(0) {};
+
+	V & operator [] (const K & key) {
+
+		if (!counts.empty()) {
+			size_t slot = findSlot(key);
+			if (counts[slot] != 0)
+				return counts[slot];
+		}
+
+		if (entries + 1 > maxEntries(counts.size()))
+			grow();
+
+		size_t slot = findSlot(key);
+		keys[slot] = key;
+		entries++;
+		return counts[slot];
+
+	};
+
+	iterator begin() { return iterator(this, 0); };
+	iterator end() { return iterator(this, counts.size()); };
+
+	size_t size() const { return entries; };
+	bool empty() const { return entries == 0; };
+
+	//Slot arrays held, which clear() keeps for the next fill
+	size_t getBytesReserved() const { return counts.size() * (sizeof(K) + sizeof(V)); };
+
+	//Peak bytes of the slot arrays on the way to holding n entries. If that takes growing, the last
+	//rehash has the old arrays alive next to the new ones, so both are counted.
+	size_t getBytesToHold(size_t n) const {
+
+		size_t slots = counts.size();
+		size_t previous = 0;
+		while (n > maxEntries(slots)) {
+			previous = slots;
+			slots = std::max<size_t>(2 * slots, minSlots);
+		}
+
+		return (slots + previous) * (sizeof(K) + sizeof(V));
+
+	};
+
+	//Empties the table but keeps its slots, so a table that is refilled to the same size doesn't rehash
+	void clear() {
+
+		std::fill(counts.begin(), counts.end(), 0);
+		std::fill(keys.begin(), keys.end(), K()); //drops the heap memory of vector keys
+		entries = 0;
+
+	};
+
+private:
+
+	static const size_t minSlots = 1024;
+
+	static size_t maxEntries(size_t slots) { return slots / 4 * 3; };
+
+	//The key hashers XOR registers together and std::hash leaves integers as they are, which would pile
+	//kmers up in neighbouring slots, so the hash is mixed (splitmix64's finalizer) before it's masked.
+	size_t getHome(const K & key) const {
+
+		uint64_t value = hash(key);
+		value ^= value >> 30;
+		value *= 0xbf58476d1ce4e5b9ull;
+		value ^= value >> 27;
+		value *= 0x94d049bb133111ebull;
+		value ^= value >> 31;
+
+		return value & (counts.size() - 1);
+
+	};
+
+	//Slot holding key, or the empty slot it would go in. Linear probing, the table is never full.
+	size_t findSlot(const K & key) const {
+
+		size_t mask = counts.size() - 1;
+		size_t slot = getHome(key);
+
+		while (counts[slot] != 0 && !(keys[slot] == key))
+			slot = (slot + 1) & mask;
+
+		return slot;
+
+	};
+
+	void grow() {
+
+		std::vector<K> oldKeys;
+		std::vector<V> oldCounts;
+		oldKeys.swap(keys);
+		oldCounts.swap(counts);
+
+		size_t slots = std::max<size_t>(2 * oldCounts.size(), minSlots);
+		keys.resize(slots);
+		counts.resize(slots, 0);
+
+		for (size_t i = 0; i < oldCounts.size(); i++) {
+			if (oldCounts[i] == 0)
+				continue;
+			size_t slot = findSlot(oldKeys[i]);
+			keys[slot] = std::move(oldKeys[i]);
+			counts[slot] = oldCounts[i];
+		}
+
+	};
+
+	std::vector<K> keys;
+	std::vector<V> counts; //0 for empty slots; the number of slots is a power of two
+	size_t entries;
+	Hash hash;
+
+};
+
+template <class K, typename V, class Hash> const size_t CompactCountTable<K, V, Hash>::minSlots;
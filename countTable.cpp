@@ -0,0 +1,436 @@
+#include "countTable.h"
+#include "keyCodec.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <memory>
+#include <queue>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+CountTableWriter::CountTableWriter(string _path, size_t _kmerWidth, size_t _countBytes, size_t _indexStride, size_t runBytes)
+	:path(_path), kmerWidth(_kmerWidth), keyBytes(KeyCodec::packedBytes(_kmerWidth)), countBytes(_countBytes), indexStride(_indexStride), entryCount(0), fileSize(0) {
+
+	recordBytes = keyBytes + countBytes;
+
+	//Runs are sorted in place, but growing one briefly holds the old buffer next to the new one,
+	//which is smaller than the full run, so each gets half
+	runRecords = max<size_t>(1, runBytes / 2 / recordBytes);
+
+}
+
+void CountTableWriter::add(const char * key, size_t _keyBytes, uint64_t count) {
+
+	if (addError.isError())
+		return;
+
+	if (_keyBytes != keyBytes) {
+		addError = KmerError(1, "Count tables can only be written from packed database keys");
+		return;
+	}
+
+	//Grow by doubling, but never past a full run, so the buffer stays within runBytes
+	size_t offset = run.size();
+	if (offset + recordBytes > run.capacity())
+		run.reserve(min(max<size_t>(2 * run.capacity(), 64 * 1024), runRecords * recordBytes));
+	run.resize(offset + recordBytes);
+
+	memcpy(&run[offset], key, keyBytes);
+	for (size_t i = 0; i < countBytes; i++)
+		run[offset + keyBytes + i] = (unsigned char)(count >> (8 * i));
+
+	entryCount++;
+
+	if (run.size() >= runRecords * recordBytes)
+		addError = spillRun();
+
+}
+
+//In place MSD radix sort (American flag sort) of fixed size records by their little endian key, most
+//significant byte first. Each record is swapped straight into its byte's bucket, so beyond the bucket
+//table of each level the only scratch space is one record. Small buckets are finished by insertion sort.
+static void sortRecords(unsigned char * data, size_t records, size_t recordBytes, size_t keyBytes, size_t byte, unsigned char * scratch) {
+
+	if (records < 32) {
+
+		for (size_t i = 1; i < records; i++) {
+
+			size_t j = i;
+			if (KeyCodec::compare(data + (j - 1) * recordBytes, data + j * recordBytes, keyBytes) <= 0)
+				continue;
+
+			memcpy(scratch, data + i * recordBytes, recordBytes);
+			while (j > 0 && KeyCodec::compare(data + (j - 1) * recordBytes, scratch, keyBytes) > 0) {
+				memcpy(data + j * recordBytes, data + (j - 1) * recordBytes, recordBytes);
+				j--;
+			}
+			memcpy(data + j * recordBytes, scratch, recordBytes);
+
+		}
+
+		return;
+
+	}
+
+	size_t counts[256] = { 0 };
+	for (size_t i = 0; i < records; i++)
+		counts[data[i * recordBytes + byte]]++;
+
+	size_t next[256], ends[256];
+	for (size_t b = 0, start = 0; b < 256; b++) {
+		next[b] = start;
+		start += counts[b];
+		ends[b] = start;
+	}
+
+	for (size_t b = 0; b < 256; b++) {
+
+		while (next[b] < ends[b]) {
+
+			unsigned char * record = data + next[b] * recordBytes;
+			unsigned char value = record[byte];
+
+			if (value == b) {
+				next[b]++;
+				continue;
+			}
+
+			unsigned char * other = data + next[value]++ * recordBytes;
+			memcpy(scratch, other, recordBytes);
+			memcpy(other, record, recordBytes);
+			memcpy(record, scratch, recordBytes);
+
+		}
+
+	}
+
+	if (byte == 0)
+		return;
+
+	for (size_t b = 0, start = 0; b < 256; start += counts[b], b++)
+		sortRecords(data + start * recordBytes, counts[b], recordBytes, keyBytes, byte - 1, scratch);
+
+}
+
+KmerError CountTableWriter::sortRun() {
+
+	vector<unsigned char> scratch(recordBytes);
+	sortRecords(run.data(), run.size() / recordBytes, recordBytes, keyBytes, keyBytes - 1, scratch.data());
+
+	return KmerError();
+
+}
+
+KmerError CountTableWriter::spillRun() {
+
+	auto err = sortRun();
+	if (err.isError()) return err;
+
+	string runPath = path + ".run" + to_string(runPaths.size());
+
+	ofstream out(runPath.c_str(), ios_base::binary);
+	out.write((const char *)run.data(), run.size());
+	out.close();
+
+	if (out.fail())
+		return KmerError(1, "Error writing count table run " + runPath);
+
+	runPaths.push_back(runPath);
+	run.clear();
+
+	return KmerError();
+
+}
+
+KmerError CountTableWriter::finish() {
+
+	if (addError.isError())
+		return addError;
+
+	auto err = writeTable();
+
+	for (auto & i : runPaths)
+		remove(i.c_str());
+	runPaths.clear();
+
+	return err;
+
+}
+
+KmerError CountTableWriter::writeTable() {
+
+	KmerError err;
+
+	ofstream out(path.c_str(), ios_base::binary);
+	if (out.fail())
+		return KmerError(1, "Error opening count table " + path);
+
+	CountTableHeader header;
+	memset(&header, 0, sizeof(header));
+	out.write((const char *)&header, sizeof(header)); //placeholder until the counts are known
+
+	vector<unsigned char> index;
+	size_t written = 0;
+
+	auto emit = [&](const unsigned char * record) {
+
+		if (indexStride && written % indexStride == 0)
+			index.insert(index.end(), record, record + keyBytes);
+
+		out.write((const char *)record, recordBytes);
+		written++;
+
+	};
+
+	if (runPaths.empty()) {
+
+		err = sortRun();
+		if (err.isError()) return err;
+
+		for (size_t i = 0; i < run.size(); i += recordBytes)
+			emit(&run[i]);
+
+	}
+	else {
+
+		if (!run.empty()) {
+			err = spillRun();
+			if (err.isError()) return err;
+		}
+
+		vector<unsigned char>().swap(run);
+
+		//k-way merge of the sorted runs
+		struct RunReader {
+			ifstream in;
+			vector<unsigned char> record;
+		};
+
+		vector<unique_ptr<RunReader>> readers;
+		for (auto & i : runPaths) {
+			readers.emplace_back(new RunReader());
+			readers.back()->in.open(i.c_str(), ios_base::binary);
+			readers.back()->record.resize(recordBytes);
+			if (readers.back()->in.fail())
+				return KmerError(1, "Error opening count table run " + i);
+		}
+
+		size_t keySize = keyBytes;
+		auto later = [&readers, keySize](size_t a, size_t b) {
+			return KeyCodec::compare(readers[a]->record.data(), readers[b]->record.data(), keySize) > 0;
+		};
+
+		priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+
+		for (size_t i = 0; i < readers.size(); i++)
+			if (readers[i]->in.read((char *)readers[i]->record.data(), recordBytes))
+				heap.push(i);
+
+		while (!heap.empty()) {
+
+			size_t next = heap.top();
+			heap.pop();
+
+			emit(readers[next]->record.data());
+
+			if (readers[next]->in.read((char *)readers[next]->record.data(), recordBytes))
+				heap.push(next);
+
+		}
+
+	}
+
+	if (written != entryCount)
+		return KmerError(1, "Count table lost records while merging runs");
+
+	memcpy(header.magic, CountTableHeader::getMagic(), strlen(CountTableHeader::getMagic()));
+	header.version = CountTableHeader::currentVersion;
+	header.kmerWidth = kmerWidth;
+	header.encoding = CountTableHeader::keyCodecEncoding;
+	header.keyBytes = keyBytes;
+	header.countBytes = countBytes;
+	header.indexStride = indexStride;
+	header.entryCount = entryCount;
+	header.dataOffset = sizeof(header);
+	header.indexOffset = sizeof(header) + entryCount * recordBytes;
+	header.indexCount = index.size() / keyBytes;
+
+	out.write((const char *)index.data(), index.size());
+	out.seekp(0);
+	out.write((const char *)&header, sizeof(header));
+
+	fileSize = header.indexOffset + index.size();
+
+	out.close();
+	if (out.fail())
+		return KmerError(1, "Error writing count table " + path);
+
+	return KmerError();
+
+}
+
+CountTableWriter::~CountTableWriter() {
+
+	//finish() wasn't reached
+	for (auto & i : runPaths)
+		remove(i.c_str());
+
+}
+
+bool CountTableReader::isCountTable(string path) {
+
+	char magic[8] = {0};
+	ifstream in(path.c_str(), ios_base::binary);
+	in.read(magic, sizeof(magic));
+
+	return in && memcmp(magic, CountTableHeader::getMagic(), strlen(CountTableHeader::getMagic()) + 1) == 0;
+
+}
+
+CountTableReader::CountTableReader(string _path) :path(_path), fd(-1), mapping(MAP_FAILED), mappingBytes(0), data(nullptr) {
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw KmerError(1, "Unable to open count table " + path);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CountTableHeader)) {
+		close(fd);
+		throw KmerError(1, "Count table " + path + " is too short");
+	}
+
+	mappingBytes = st.st_size;
+	mapping = mmap(nullptr, mappingBytes, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		close(fd);
+		throw KmerError(1, "Unable to map count table " + path);
+	}
+
+	memcpy(&header, mapping, sizeof(header));
+
+	KmerError err;
+	if (memcmp(header.magic, CountTableHeader::getMagic(), strlen(CountTableHeader::getMagic()) + 1) != 0)
+		err = KmerError(1, path + " is not a count table");
+	else if (header.version != CountTableHeader::currentVersion || header.encoding != CountTableHeader::keyCodecEncoding)
+		err = KmerError(1, "Count table " + path + " has an unsupported version or key encoding");
+	else if (header.keyBytes != KeyCodec::packedBytes(header.kmerWidth) || header.countBytes == 0 || header.countBytes > sizeof(uint64_t))
+		err = KmerError(1, "Count table " + path + " has an invalid record layout");
+	else if (header.dataOffset + header.entryCount * (header.keyBytes + header.countBytes) > mappingBytes
+		|| header.indexOffset + header.indexCount * header.keyBytes > mappingBytes)
+		err = KmerError(1, "Count table " + path + " is truncated");
+
+	if (err.isError()) {
+		munmap(mapping, mappingBytes);
+		close(fd);
+		throw err;
+	}
+
+	recordBytes = header.keyBytes + header.countBytes;
+	data = (const unsigned char *)mapping + header.dataOffset;
+
+	//lookups jump around the table, read ahead doesn't help
+	madvise(mapping, mappingBytes, MADV_RANDOM);
+
+	const unsigned char * indexStart = (const unsigned char *)mapping + header.indexOffset;
+	index.assign(indexStart, indexStart + header.indexCount * header.keyBytes);
+
+}
+
+uint64_t CountTableReader::getCount(uint64_t i) {
+
+	const unsigned char * count = getKey(i) + header.keyBytes;
+
+	uint64_t value = 0;
+	for (size_t b = header.countBytes; b-- > 0;)
+		value = (value << 8) | count[b];
+
+	return value;
+
+}
+
+uint64_t CountTableReader::lowerBound(const unsigned char * key) {
+
+	uint64_t first = 0, last = header.entryCount;
+	while (first < last) {
+		uint64_t mid = first + (last - first) / 2;
+		if (KeyCodec::compare(getKey(mid), key, header.keyBytes) < 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return first;
+
+}
+
+void CountTableReader::lookup(const vector<const unsigned char *> & keys, const vector<size_t> & order, vector<uint64_t> & counts) {
+
+	counts.assign(keys.size(), 0);
+
+	size_t keySize = header.keyBytes;
+	uint64_t low = 0; //no later key sorts before this record
+
+	for (auto i : order) {
+
+		const unsigned char * key = keys[i];
+
+		//the index block holding the key bounds the search, when there's an index
+		uint64_t high = header.entryCount;
+		if (header.indexCount) {
+
+			uint64_t first = low / header.indexStride, last = header.indexCount;
+			while (first < last) {
+				uint64_t mid = first + (last - first) / 2;
+				if (KeyCodec::compare(&index[mid * keySize], key, keySize) <= 0)
+					first = mid + 1;
+				else
+					last = mid;
+			}
+
+			//first is the first block starting after the key
+			high = min<uint64_t>(high, first * header.indexStride);
+			if (first > 0)
+				low = max<uint64_t>(low, (first - 1) * header.indexStride);
+
+		}
+		else {
+
+			//gallop from the previous position so a batch of nearby keys stays local
+			uint64_t step = 1;
+			while (low + step < high && KeyCodec::compare(getKey(low + step), key, keySize) < 0)
+				step *= 2;
+			high = min<uint64_t>(high, low + step + 1);
+
+		}
+
+		//lower bound inside [low, high)
+		uint64_t first = low, last = high;
+		while (first < last) {
+			uint64_t mid = first + (last - first) / 2;
+			if (KeyCodec::compare(getKey(mid), key, keySize) < 0)
+				first = mid + 1;
+			else
+				last = mid;
+		}
+
+		low = first;
+
+		if (first < header.entryCount && KeyCodec::compare(getKey(first), key, keySize) == 0)
+			counts[i] = getCount(first);
+
+	}
+
+}
+
+CountTableReader::~CountTableReader() {
+
+	if (mapping != MAP_FAILED)
+		munmap(mapping, mappingBytes);
+	if (fd >= 0)
+		close(fd);
+
+}
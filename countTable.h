@@ -0,0 +1,124 @@
+#pragma once
+
+#include "kmerError.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+//Binary count table: every (kmer, count) pair of a run, sorted, with a fixed size header so other
+//jobs can mmap the file and binary search it without parsing anything.
+//
+//Layout: CountTableHeader, entryCount records at dataOffset, then indexCount keys at indexOffset.
+//A record is keyBytes of packed key (KeyCodec: 3 bits per base, G=0 T=1 C=2 A=3 N=4, last base in the
+//lowest bits, little endian) followed by countBytes of little endian count. Records are sorted by key
+//as a little endian number (KeyCodec::compare), which is lexicographic order over the encoded bases.
+//The optional sparse index holds the key of every indexStride-th record, small enough to keep in
+//memory and narrow a lookup down to one block of records.
+struct CountTableHeader {
+
+	char magic[8];
+	uint32_t version;
+	uint32_t kmerWidth;
+	uint32_t encoding;
+	uint32_t keyBytes;
+	uint32_t countBytes;
+	uint32_t indexStride; //0 when there's no index
+	uint64_t entryCount;
+	uint64_t dataOffset;
+	uint64_t indexOffset;
+	uint64_t indexCount;
+
+	static const char * getMagic() { return "KMERTAB"; };
+	static const uint32_t currentVersion = 1;
+	static const uint32_t keyCodecEncoding = 1;
+
+};
+
+static_assert(sizeof(CountTableHeader) == 64, "CountTableHeader layout is part of the file format");
+
+//Writes a count table from records arriving in any order. Records are collected in runs that, with
+//their growth and sort, stay within runBytes; a run that fills up is sorted in place and spilled next
+//to the output, and the runs are merged at the end, so the table can be much larger than memory.
+class CountTableWriter {
+
+public:
+
+	CountTableWriter(std::string path, size_t kmerWidth, size_t countBytes, size_t indexStride = 0, size_t runBytes = 256 * 1024 * 1024);
+
+	//key is the packed kmer as stored in the database. Errors are kept for finish(), since this is
+	//called from inside a database scan.
+	void add(const char * key, size_t keyBytes, uint64_t count);
+
+	//Sorts, merges and writes the table
+	KmerError finish();
+
+	size_t getEntryCount() { return entryCount; };
+	size_t getFileSize() { return fileSize; };
+
+	~CountTableWriter();
+
+private:
+
+	KmerError spillRun();
+	KmerError sortRun();
+	KmerError writeTable();
+
+	std::string path;
+	size_t kmerWidth;
+	size_t keyBytes;
+	size_t countBytes;
+	size_t recordBytes;
+	size_t indexStride;
+	size_t runRecords;
+
+	std::vector<unsigned char> run;
+	std::vector<std::string> runPaths;
+	size_t entryCount;
+	size_t fileSize;
+	KmerError addError;
+
+};
+
+//Read side of a count table. The file is mapped rather than read, and only the sparse index is kept
+//in memory, so opening a table costs the same whatever its size.
+class CountTableReader {
+
+public:
+
+	//Throws KmerError when the file can't be mapped or isn't a count table
+	CountTableReader(std::string path);
+
+	//Looks up packed keys (keyBytes each) and fills in their counts, 0 for keys that aren't in the
+	//table. order must list the keys sorted by KeyCodec::compare: each lookup then starts from where
+	//the previous one ended, narrowed through the index, instead of from the whole table.
+	void lookup(const std::vector<const unsigned char *> & keys, const std::vector<size_t> & order, std::vector<uint64_t> & counts);
+
+	const CountTableHeader & getHeader() { return header; };
+
+	//Direct access to the sorted records, for merging tables
+	uint64_t getEntryCount() { return header.entryCount; };
+	const unsigned char * getKey(uint64_t i) { return data + i * recordBytes; };
+	uint64_t getCount(uint64_t i);
+
+	//Index of the first record whose key isn't below key
+	uint64_t lowerBound(const unsigned char * key);
+
+	//True when path starts with the count table magic, for telling tables from databases
+	static bool isCountTable(std::string path);
+
+	~CountTableReader();
+
+private:
+
+	std::string path;
+	CountTableHeader header;
+	size_t recordBytes;
+
+	int fd;
+	void * mapping;
+	size_t mappingBytes;
+	const unsigned char * data;
+	std::vector<unsigned char> index;
+
+};
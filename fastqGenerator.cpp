@@ -0,0 +1,239 @@
+#include "kmerUtils.h"
+#include <random>
+#include <unordered_map>
+#include <fstream>
+
+using namespace KmerUtils;
+using namespace std;
+
+//Writes a reproducible synthetic FASTQ file and its ground truth top kmers.
+//
+//Reads are random GTAC background. A configurable fraction of them carries one "motif" kmer drawn from a
+//Zipf distribution (skew), so a handful of kmers are very abundant and the rest appear about once. Substitution
+//errors are applied afterwards at errorRate per base.
+//
+//The abundant kmers are the motifs and the kmers straddling a motif and its random neighbours: shifted by one
+//base they keep a quarter of the motif's count, by two bases a sixteenth. Every read is scanned for all of
+//these candidates (motifs plus shifts of up to two bases), so the truth file holds their exact counts, errors
+//and chance occurrences included. For k >= 15 background kmers almost never repeat and further shifts are
+//rarer still, so the top N candidates are the top N kmers of the file.
+//
+//Usage: fastqGenerator <output> <reads> [--read-length 150] [--kmer-size 31] [--error-rate 0.01] [--motifs 1000]
+//                      [--skew 1.0] [--motif-fraction 0.5] [--top 25] [--truth <output>.truth] [--seed 1]
+
+struct GeneratorParams {
+	string outputPath;
+	string truthPath;
+	size_t reads;
+	size_t readLength;
+	size_t kmerWidth;
+	double errorRate;
+	size_t motifs;
+	double skew;
+	double motifFraction;
+	size_t top;
+	size_t seed;
+};
+
+static const char bases[] = "GTAC";
+
+static uint64_t packBase(char base) {
+	switch (base) {
+	case 'G': return 0;
+	case 'T': return 1;
+	case 'C': return 2;
+	default: return 3;
+	}
+}
+
+static KmerError generate(GeneratorParams & params) {
+
+	if (params.kmerWidth == 0 || params.kmerWidth > 32)
+		return KmerError(1, "kmer size must be between 1 and 32 to track ground truth");
+
+	if (params.readLength < params.kmerWidth)
+		return KmerError(1, "Read length must be at least the kmer size");
+
+	if (params.kmerWidth < 15)
+		cerr << "Warning. Background kmers repeat often for k < 15, the truth file only covers kmers around the planted motifs." << endl;
+
+	ofstream out(params.outputPath.c_str(), ios_base::binary);
+	if (out.fail())
+		return KmerError(1, "Error opening " + params.outputPath);
+
+	mt19937_64 rng(params.seed);
+	uniform_int_distribution<int> base(0, 3);
+	uniform_int_distribution<int> otherBase(1, 3);
+	uniform_real_distribution<double> unit(0.0, 1.0);
+	uniform_int_distribution<size_t> position(0, params.readLength - params.kmerWidth);
+
+	//Motifs and their Zipf weights
+	vector<string> motifs(params.motifs);
+	vector<double> weights(params.motifs);
+
+	//Candidate kmers tracked for the truth file, packed 2 bits per base
+	unordered_map<uint64_t, size_t> candidateIndex;
+	vector<string> candidates;
+
+	uint64_t mask = params.kmerWidth == 32 ? ~(uint64_t)0 : ((uint64_t)1 << (2 * params.kmerWidth)) - 1;
+
+	auto packKmer = [](const string & kmer) {
+		uint64_t packed = 0;
+		for (auto c : kmer)
+			packed = (packed << 2) | packBase(c);
+		return packed;
+	};
+
+	auto addCandidate = [&](const string & kmer) {
+		if (candidateIndex.emplace(packKmer(kmer), candidates.size()).second)
+			candidates.push_back(kmer);
+	};
+
+	for (size_t i = 0; i < motifs.size(); i++) {
+
+		do {
+			motifs[i].resize(params.kmerWidth);
+			for (auto & c : motifs[i])
+				c = bases[base(rng)];
+		} while (candidateIndex.count(packKmer(motifs[i])));
+
+		addCandidate(motifs[i]);
+		weights[i] = 1.0 / pow((double)(i + 1), params.skew);
+
+	}
+
+	//Shifts of one and two bases in either direction, with every possible neighbour
+	const string neighbours[] = { "G", "T", "A", "C", "GG", "GT", "GA", "GC", "TG", "TT", "TA", "TC", "AG", "AT", "AA", "AC", "CG", "CT", "CA", "CC" };
+
+	for (auto & motif : motifs) {
+		for (auto & n : neighbours) {
+			if (n.size() >= motif.size())
+				continue;
+			addCandidate(motif.substr(n.size()) + n);
+			addCandidate(n + motif.substr(0, motif.size() - n.size()));
+		}
+	}
+
+	discrete_distribution<size_t> pickMotif(weights.begin(), weights.end());
+	vector<size_t> truth(candidates.size(), 0);
+
+	string read(params.readLength, 'G');
+	string quality(params.readLength, 'I');
+
+	for (size_t r = 0; r < params.reads; r++) {
+
+		for (auto & c : read)
+			c = bases[base(rng)];
+
+		if (!motifs.empty() && unit(rng) < params.motifFraction)
+			read.replace(position(rng), params.kmerWidth, motifs[pickMotif(rng)]);
+
+		//Substitution errors always change the base
+		if (params.errorRate > 0) {
+			for (auto & c : read) {
+				if (unit(rng) < params.errorRate)
+					c = bases[(packBase(c) + otherBase(rng)) % 4];
+			}
+		}
+
+		//Count every candidate occurrence in the final read
+		uint64_t packed = 0;
+		for (size_t i = 0; i < read.size(); i++) {
+			packed = ((packed << 2) | packBase(read[i])) & mask;
+			if (i + 1 >= params.kmerWidth) {
+				auto found = candidateIndex.find(packed);
+				if (found != candidateIndex.end())
+					truth[found->second]++;
+			}
+		}
+
+		out << "@synthetic." << r << '\n' << read << "\n+\n" << quality << '\n';
+
+	}
+
+	if (out.fail())
+		return KmerError(1, "Error writing " + params.outputPath);
+
+	//Ground truth in the same seq,count format kmerCounter writes, most frequent first, ties by sequence
+	vector<size_t> order(candidates.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return truth[a] != truth[b] ? truth[a] > truth[b] : candidates[a] < candidates[b];
+	});
+
+	ofstream truthOut(params.truthPath.c_str(), ios_base::binary);
+	if (truthOut.fail())
+		return KmerError(1, "Error opening " + params.truthPath);
+
+	for (size_t i = 0; i < min(params.top, order.size()); i++)
+		truthOut << candidates[order[i]] << "," << truth[order[i]] << '\n';
+
+	return KmerError();
+
+}
+
+int main(int argc, char * argv[]) {
+
+	vector<string> args;
+	KmerError err = getAllArguments(argc, argv, args);
+	if (err.isError()) return displayError(err, cerr);
+
+	map<string, string> options;
+	err = getOptions(args, options);
+	if (err.isError()) return displayError(err, cerr);
+
+	if (args.size() != 3) {
+		cerr << "Usage: fastqGenerator <output> <reads> [--read-length 150] [--kmer-size 31] [--error-rate 0.01] [--motifs 1000]" << endl;
+		cerr << "                      [--skew 1.0] [--motif-fraction 0.5] [--top 25] [--truth <output>.truth] [--seed 1]" << endl;
+		return 1;
+	}
+
+	GeneratorParams params;
+	params.outputPath = args[1];
+	params.truthPath = params.outputPath + ".truth";
+	params.readLength = 150;
+	params.kmerWidth = 31;
+	params.errorRate = 0.01;
+	params.motifs = 1000;
+	params.skew = 1.0;
+	params.motifFraction = 0.5;
+	params.top = 25;
+	params.seed = 1;
+
+	try {
+
+		params.reads = stoull(args[2]);
+
+		for (auto & i : options) {
+			if (i.first == "--read-length")
+				params.readLength = stoull(i.second);
+			else if (i.first == "--kmer-size")
+				params.kmerWidth = stoull(i.second);
+			else if (i.first == "--error-rate")
+				params.errorRate = stod(i.second);
+			else if (i.first == "--motifs")
+				params.motifs = stoull(i.second);
+			else if (i.first == "--skew")
+				params.skew = stod(i.second);
+			else if (i.first == "--motif-fraction")
+				params.motifFraction = stod(i.second);
+			else if (i.first == "--top")
+				params.top = stoull(i.second);
+			else if (i.first == "--truth")
+				params.truthPath = i.second;
+			else if (i.first == "--seed")
+				params.seed = stoull(i.second);
+			else
+				return displayError(KmerError(1, "Unknown option " + i.first), cerr);
+		}
+
+	}
+	catch (std::exception & e) {
+		return displayError(e, cerr);
+	}
+
+	return displayError(generate(params), cerr);
+
+}
@@ -1,15 +1,26 @@
 #include "fastqReader.h"
+#include "kmerStats.h"
 #include <algorithm>
 #include <locale>
 
 using namespace std;
 
-FastqReader::FastqReader(std::istream & _path):inputStream(_path) {
+FastqReader::FastqReader(std::istream & _path):inputStream(_path), skippedReads(0), skippedBytes(0), minQualityChar(0), maskedBases(0), entryBytes(0) {
+}
+
+void FastqReader::setSampler(std::function<bool(const std::string & seqID)> keep) {
+	sampler = keep;
+}
+
+void FastqReader::setMinQuality(unsigned minQuality) {
+	minQualityChar = minQuality ? (char)(minQuality + 33) : 0;
 }
 
 //Gets entry, and ensures that entry isn't corrupted. This does assume that there are no blank lines between entries or within a record.
 KmerError FastqReader::getEntry(FastqEntry & entry) {
 
+	KMER_STATS_SCOPE(Parse);
+
 	//check input stream
 	if (inputStream.fail())
 		return KmerError(5, "Input stream is bad. Is it open?");
@@ -17,24 +28,37 @@ KmerError FastqReader::getEntry(FastqEntry & entry) {
 	//Reset entry
 	entry = FastqEntry();
 
-	//Read entry info
+	//Read entry info, passing over the records the sampler leaves out
 	getline(inputStream, entry.seqID);
-	getline(inputStream, entry.sequence);
-	getline(inputStream, entry.alignment);
-	getline(inputStream, entry.quality);
+
+	while (sampler && inputStream.good() && !sampler(entry.seqID)) {
+
+		skippedReads++;
+		skippedBytes += entry.seqID.size() + 1 + readRecord(entry);
+
+		getline(inputStream, entry.seqID);
+
+	}
+
+	entryBytes = entry.seqID.size() + 1 + readRecord(entry);
 
 	if (inputStream.fail())
 		return KmerError(1, "Error while reading from FASTQ file");
+
+	KMER_STATS_ADD(Reads, 1);
+	KMER_STATS_ADD(Bytes, entryBytes);
 	
 	try {
 
-		auto err = checkSequence(entry.sequence);
+		bool fasta = entry.seqID[0] == '>';
+
+		auto err = checkSequence(entry.sequence, entry.quality, !fasta);
 		if (err.isError()) return err;
 
-		if (entry.seqID[0] != '@')
+		if (entry.seqID[0] != '@' && !fasta)
 			return KmerError(2, "Malformed FASTQ entry. Sequence ID doesn't begin with @");
 
-		if (entry.alignment[0] != '+')
+		if (entry.alignment[0] != '+' && !fasta)
 			return KmerError(3, "Malformed FASTQ entry. Third line doesn't begin with +");
 
 	}
@@ -46,18 +70,74 @@ KmerError FastqReader::getEntry(FastqEntry & entry) {
 
 }
 
-//Make sure that the sequence doesn't contain bogus characters.
-KmerError FastqReader::checkSequence(std::string & sequence) {
+//A FASTA sequence runs until the next '>' line. A FASTQ one runs until the '+' line, and its quality
+//until it's as long as the sequence, since quality lines may start with '@' or '+' themselves.
+//The next line is looked at through the stream buffer, so the stream only sees the end of the input
+//on the record's last line, and only then if that line has no newline. See FastqReader::atEnd.
+size_t FastqReader::readRecord(FastqEntry & entry) {
+
+	bool fasta = !entry.seqID.empty() && entry.seqID[0] == '>';
+	char sequenceEnd = fasta ? '>' : '+';
+
+	getline(inputStream, entry.sequence);
+	size_t bytes = entry.sequence.size() + 1;
+
+	std::string line;
+	auto buffer = inputStream.rdbuf();
+
+	while (inputStream.good()) {
+		int next = buffer->sgetc();
+		if (next == std::char_traits<char>::eof() || next == sequenceEnd)
+			break;
+		getline(inputStream, line);
+		bytes += line.size() + 1;
+		entry.sequence += line;
+	}
+
+	entry.alignment.clear();
+	entry.quality.clear();
+
+	if (fasta)
+		return bytes;
+
+	getline(inputStream, entry.alignment);
+	getline(inputStream, entry.quality);
+	bytes += entry.alignment.size() + entry.quality.size() + 2;
+
+	while (inputStream.good() && entry.quality.size() < entry.sequence.size()) {
+		getline(inputStream, line);
+		bytes += line.size() + 1;
+		entry.quality += line;
+	}
+
+	return bytes;
+
+}
+
+//Make sure that the sequence doesn't contain bogus characters, masking low quality bases on the way.
+KmerError FastqReader::checkSequence(std::string & sequence, const std::string & quality, bool hasQuality) {
 
 	std::locale loc;
 
-	for (auto & i : sequence) {
+	bool masking = minQualityChar != 0 && hasQuality;
+
+	if (masking && quality.size() != sequence.size())
+		return KmerError(1, "Malformed FASTQ entry. Quality line length doesn't match the sequence");
+
+	for (size_t pos = 0; pos < sequence.size(); pos++) {
+
+		auto & i = sequence[pos];
 
 		char t = std::toupper(i, loc); //upper or lower case is valid, convert to upper and only check that
 
 		if (t != 'G' && t != 'A' && t != 'T' && t != 'C' && t != 'N')
 			return KmerError(1, "Got invalid base pair with ASCII value : " + to_string(i));
 
+		if (masking && quality[pos] < minQualityChar) {
+			i = maskedBase;
+			maskedBases++;
+		}
+
 	};
 
 	return KmerError();
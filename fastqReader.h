@@ -1,9 +1,12 @@
 #pragma once
 
 #include "kmerError.h"
+#include "merizer.h"
 #include <istream>
+#include <functional>
 
-//Class that manages reading from Fastq file
+//Class that manages reading from Fastq file. FASTA files are read too, records starting with '>' have
+//no alignment or quality. Sequences and qualities may be wrapped over several lines, as long reads often are.
 class FastqReader {
 
 public:
@@ -19,10 +22,39 @@ public:
 
 	KmerError getEntry(FastqEntry & entry);
 
+	//Whether the last getEntry ran out of input instead of reading an entry. A last record without a
+	//trailing newline is still read whole, with the stream at its end but not failed.
+	bool atEnd() { return inputStream.eof() && inputStream.fail(); };
+
+	//Records whose ID keep rejects are passed over by getEntry. They're only scanned for their line
+	//breaks, not validated or stored.
+	void setSampler(std::function<bool(const std::string & seqID)> keep);
+
+	size_t getSkippedReads() { return skippedReads; };
+	size_t getSkippedBytes() { return skippedBytes; };
+
+	//Bases whose Phred+33 quality is below minQuality are replaced with maskedBase while the
+	//sequence is validated, so no kmer is counted across them. Zero turns masking off.
+	void setMinQuality(unsigned minQuality);
+
+	size_t getMaskedBases() { return maskedBases; };
+
+	//Input bytes of the last entry, line breaks included
+	size_t getEntryBytes() { return entryBytes; };
+
 private:
 
-	KmerError checkSequence(std::string & checkSequence);
+	KmerError checkSequence(std::string & checkSequence, const std::string & quality, bool hasQuality);
+
+	//Reads the lines after a record's ID, returns the bytes read
+	size_t readRecord(FastqEntry & entry);
 
 	std::istream & inputStream;
+	std::function<bool(const std::string & seqID)> sampler;
+	size_t skippedReads;
+	size_t skippedBytes;
+	char minQualityChar;
+	size_t maskedBases;
+	size_t entryBytes;
 	
 };
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "footprint.h"
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+static const char * subsystemNames[] = { "reader", "tables", "flushTables", "topCache", "databaseMap", "databaseFile" };
+
+static string toMB(size_t bytes) {
+	ostringstream out;
+	out << fixed << setprecision(1) << bytes / (1024.0 * 1024.0) << " MB";
+	return out.str();
+}
+
+Footprint::Footprint() :peakMemory(0), memoryLimit(0), diskLimit(0) {
+
+	for (int i = 0; i < SubsystemCount; i++) {
+		current[i] = 0;
+		peak[i] = 0;
+	}
+
+}
+
+void Footprint::setLimits(size_t _memoryLimit, size_t _diskLimit) {
+	memoryLimit = _memoryLimit;
+	diskLimit = _diskLimit;
+}
+
+const char * Footprint::getName(Subsystem subsystem) {
+	return subsystemNames[subsystem];
+}
+
+void Footprint::raise(std::atomic<size_t> & peakValue, size_t value) {
+
+	size_t seen = peakValue.load(memory_order_relaxed);
+	while (value > seen && !peakValue.compare_exchange_weak(seen, value, memory_order_relaxed));
+
+}
+
+size_t Footprint::getMemory() {
+
+	size_t total = 0;
+	for (int i = 0; i < SubsystemCount; i++)
+		if (isMemory((Subsystem)i))
+			total += current[i].load(memory_order_relaxed);
+
+	return total;
+
+}
+
+KmerError Footprint::update(Subsystem subsystem, size_t bytes) {
+
+	current[subsystem].store(bytes, memory_order_relaxed);
+	raise(peak[subsystem], bytes);
+
+	if (!isMemory(subsystem)) {
+
+		if (diskLimit && bytes > diskLimit)
+			return KmerError(1, "Disk limit of " + toMB(diskLimit) + " exceeded: database file is " + toMB(bytes));
+
+		return KmerError();
+	}
+
+	size_t memory = getMemory();
+	raise(peakMemory, memory);
+
+	if (memoryLimit && memory > memoryLimit) {
+
+		string detail;
+		for (int i = 0; i < SubsystemCount; i++)
+			if (isMemory((Subsystem)i))
+				detail += string(detail.size() ? ", " : "") + subsystemNames[i] + " " + toMB(getCurrent((Subsystem)i));
+
+		return KmerError(1, "Memory limit of " + toMB(memoryLimit) + " exceeded by " + subsystemNames[subsystem] + ": " + detail);
+	}
+
+	return KmerError();
+
+}
+
+string Footprint::getSummary() {
+
+	ostringstream out;
+
+	out << "Peak memory [MB] : " << getPeakMemory() / (1024.0 * 1024.0) << std::endl;
+	for (int i = 0; i < SubsystemCount; i++)
+		if (isMemory((Subsystem)i))
+			out << "  " << subsystemNames[i] << " [MB] : " << getPeak((Subsystem)i) / (1024.0 * 1024.0) << std::endl;
+
+	out << "Peak disk [MB] : " << getPeakDisk() / (1024.0 * 1024.0) << std::endl;
+
+	return out.str();
+
+}
+
+string Footprint::getJson() {
+
+	ostringstream out;
+
+	out << "{\"peakMemoryBytes\": " << getPeakMemory() << ", \"peakDiskBytes\": " << getPeakDisk()
+		<< ", \"memoryLimit\": " << memoryLimit << ", \"diskLimit\": " << diskLimit << ", \"peakBytes\": {";
+
+	for (int i = 0; i < SubsystemCount; i++)
+		out << (i ? ", " : "") << "\"" << subsystemNames[i] << "\": " << getPeak((Subsystem)i);
+
+	out << "}}";
+
+	return out.str();
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "kmerError.h"
+#include <atomic>
+#include <string>
+
+//Bytes held by each subsystem of a run, with their peaks, checked against optional memory and disk limits.
+//
+//Subsystems report their current size with update(). Memory subsystems are summed and checked against
+//the memory limit, the database file against the disk limit, so a run that is about to outgrow its
+//allocation fails with an error naming the culprit instead of being OOM-killed or filling the disk.
+//Updates come from both the counting and the flusher thread, so everything is a relaxed atomic.
+class Footprint {
+
+public:
+
+	enum Subsystem {
+		Reader,       //FASTQ record buffers
+		Tables,       //the counter's active hash table or token list
+		FlushTables,  //the table being flushed plus any flush scratch space
+		TopCache,     //the database's top key cache
+		DatabaseMap,  //part of the database file Kyoto keeps memory mapped
+		DatabaseFile, //database file on disk
+		SubsystemCount
+	};
+
+	Footprint();
+
+	//0 disables a limit
+	void setLimits(size_t memoryLimit, size_t diskLimit);
+	size_t getMemoryLimit() { return memoryLimit; };
+	size_t getDiskLimit() { return diskLimit; };
+
+	//Records the current size of a subsystem. Fails if that puts memory or disk over its limit.
+	KmerError update(Subsystem subsystem, size_t bytes);
+
+	size_t getCurrent(Subsystem subsystem) { return current[subsystem].load(std::memory_order_relaxed); };
+	size_t getPeak(Subsystem subsystem) { return peak[subsystem].load(std::memory_order_relaxed); };
+
+	//Peak of the summed memory subsystems (not the sum of their individual peaks) and of the disk usage
+	size_t getPeakMemory() { return peakMemory.load(std::memory_order_relaxed); };
+	size_t getPeakDisk() { return peak[DatabaseFile].load(std::memory_order_relaxed); };
+
+	static const char * getName(Subsystem subsystem);
+	static bool isMemory(Subsystem subsystem) { return subsystem != DatabaseFile; };
+
+	//Human readable peaks, one subsystem per line
+	std::string getSummary();
+
+	//Peaks as a JSON object for --stats-json
+	std::string getJson();
+
+private:
+
+	static void raise(std::atomic<size_t> & peakValue, size_t value);
+	size_t getMemory();
+
+	std::atomic<size_t> current[SubsystemCount];
+	std::atomic<size_t> peak[SubsystemCount];
+	std::atomic<size_t> peakMemory;
+
+	size_t memoryLimit;
+	size_t diskLimit;
+
+};
@@ -0,0 +1,43 @@
+#include "histogram.h"
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+
+AbundanceHistogram::AbundanceHistogram(size_t maxCount, size_t _saturatedAt) :bins(maxCount), overflow(0), saturated(0), saturatedAt(_saturatedAt) {
+}
+
+size_t AbundanceHistogram::getDistinct() {
+
+	size_t total = overflow + saturated;
+	for (auto i : bins)
+		total += i;
+
+	return total;
+
+}
+
+KmerError AbundanceHistogram::write(string path, size_t minCount) {
+
+	ofstream out(path.c_str());
+	if (out.fail())
+		return KmerError(1, "Error opening histogram file " + path);
+
+	for (size_t i = max<size_t>(minCount, 1); i < bins.size(); i++)
+		if (bins[i])
+			out << i << " " << bins[i] << "\n";
+
+	if (overflow)
+		out << bins.size() << " " << overflow << "\n";
+
+	//A comment, so readers expecting two numeric columns (read.table, GenomeScope) skip it
+	if (saturated)
+		out << "# saturated " << saturated << "\n";
+
+	out.close();
+	if (out.fail())
+		return KmerError(1, "Error writing histogram file " + path);
+
+	return KmerError();
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "kmerError.h"
+#include <vector>
+#include <string>
+
+//Kmer abundance histogram (count of counts), for genome size and error rate estimates.
+//
+//bins[c] is the number of distinct kmers seen exactly c times. Counts of maxCount and above share the
+//last bin. Counters that hit the maximum their precision can hold are kept apart in the saturated bin,
+//since their real count is unknown.
+class AbundanceHistogram {
+
+public:
+
+	//saturatedAt is the maximum value of the counters feeding the histogram
+	AbundanceHistogram(size_t maxCount, size_t saturatedAt);
+
+	void add(size_t count) {
+
+		if (count == saturatedAt)
+			saturated++;
+		else if (count >= bins.size())
+			overflow++;
+		else
+			bins[count]++;
+
+	};
+
+	size_t getSaturated() { return saturated; };
+	size_t getDistinct();
+
+	//One "count kmers" line per non empty bin, as jellyfish histo writes them, so the file can go
+	//straight into tools like GenomeScope. The maxCount line holds every count at or above it.
+	//Bins below minCount are left out: with --min-count they only hold what earlier flushes wrote.
+	//Saturated kmers get a final "# saturated n" comment line when there are any.
+	KmerError write(std::string path, size_t minCount);
+
+private:
+
+	std::vector<size_t> bins;
+	size_t overflow;
+	size_t saturated;
+	size_t saturatedAt;
+
+};
@@ -1,15 +1,44 @@
 #include <kchashdb.h>
 #include <string>
 #include "kmerError.h"
+#include "keyCodec.h"
+#include "kmerStats.h"
+#include "topSelector.h"
+#include "histogram.h"
+#include "countTable.h"
 #include <vector>
 #include <array>
 #include <limits>
 #include <cstdio>
 #include <iostream>
 #include <list>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <sys/stat.h>
 
 #define ENABLE_CACHE 
 
+//Kept in Kyoto's 16 byte opaque region so a database that outlives its run can be checked before
+//it's reopened: its keys and counts only make sense to a counter with the same k, key encoding and precision.
+struct KeyCacheHeader {
+
+	char magic[4];
+	unsigned char version;
+	unsigned char encoding;
+	unsigned char countBytes;
+	unsigned char reserved;
+	uint32_t kmerWidth;
+	uint32_t checkpoint; //generation of the last checkpoint() committed, 0 for none
+
+	static const char * getMagic() { return "KMDB"; };
+	static const unsigned char currentVersion = 1;
+	static const unsigned char keyCodecEncoding = 1;
+
+};
+
+static_assert(sizeof(KeyCacheHeader) == 16, "KeyCacheHeader has to fit Kyoto's opaque region");
+
 //Base template for databasing mechanism to support large data files
 //
 //This class implements a caching technique to keep track
@@ -28,31 +57,78 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 
     //typedef datum KeyCache<std:;array<KeyT, NKeys>>::datum;
 
-	BaseKeyCache(std::string _cacheName, bool _cleanUp=true, size_t _topCacheSize=50):cacheName(_cacheName),cleanUp(_cleanUp),topCacheSize(_topCacheSize){
+	//Size of the memory mapped region Kyoto keeps in RAM unless the caller asks for something else
+	static size_t defaultMapSize() { return (size_t)1024*1024*1024*4; };
+
+	//Create starts a new database, replacing any file of that name. Read opens a database kept by an
+	//earlier run (cleanUp=false) read only. Append adds to a kept database, or creates it if there's none yet.
+	enum OpenMode { Create, Read, Append };
+
+	//compactCounts stores counts that fit in a byte as a single byte record value instead of sizeof(CounterType) bytes.
+	//Records of either width can be read back, the value size tells them apart.
+	//kmerWidth goes into the database header. Reading or appending to a database written for another k,
+	//key encoding or precision throws.
+	BaseKeyCache(std::string _cacheName, bool _cleanUp=true, size_t _topCacheSize=50, size_t _mapSize=defaultMapSize(), bool _compactCounts=false, size_t _kmerWidth=0, OpenMode _mode=Create):cacheName(_cacheName),cleanUp(_cleanUp),topCacheSize(_topCacheSize),mapSize(_mapSize),compactCounts(_compactCounts),mode(_mode),priorRecords(false),inTransaction(false),diskLimit(0),addsSinceCheck(0),skippedBelowMin(0),skippedBelowMinBytes(0){
+
+		db.tune_map(mapSize);
+
+		if(mode == Append && !fileExists(cacheName))
+			mode = Create;
+
+		if(mode != Create){
+
+			if(!db.open(cacheName.c_str(), mode == Read ? kyotocabinet::HashDB::OREADER : kyotocabinet::HashDB::OWRITER))
+				throw KmerError(1, "Unable to open database " + cacheName);
+
+			memcpy(&header, db.opaque(), sizeof(header));
+
+			KmerError err = checkHeader(_kmerWidth);
+			if(err.isError()){
+				db.close();
+				throw err;
+			}
+
+			priorRecords = true;
+			return;
+		}
 
 		//in case we didn't clean up before
 		remove(cacheName.c_str());
+		remove(getTopCachePath().c_str());
 
 		db.tune_options(kyotocabinet::HashDB::TLINEAR);
 		db.tune_buckets(1000*1000*50);
-		db.tune_map((size_t)1024*1024*1024*4); //1GB
 
 
 		if(!db.open(cacheName.c_str(), kyotocabinet::HashDB::OWRITER | kyotocabinet::HashDB::OCREATE))
 			throw KmerError(1, "Unable to create database");
 
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, KeyCacheHeader::getMagic(), sizeof(header.magic));
+		header.version = KeyCacheHeader::currentVersion;
+		header.encoding = KeyCacheHeader::keyCodecEncoding;
+		header.countBytes = sizeof(CounterType);
+		header.kmerWidth = _kmerWidth;
+
+		memcpy(db.opaque(), &header, sizeof(header));
+		if(!db.synchronize_opaque())
+			throw KmerError(1, "Unable to write the header of database " + cacheName);
+
 
 	}
 
-	KmerError getTopKeys(std::vector<EntryType> & entries, size_t total, CounterType minValueFilter = 0){
+	//Entries with counts below minValueFilter are left out, so fewer than total may come back.
+	//A histogram or a count table needs every record, so they always take the scan and are filled on the way.
+	KmerError getTopKeys(std::vector<EntryType> & entries, size_t total, CounterType minValueFilter = 0, AbundanceHistogram * histogram = nullptr, CountTableWriter * table = nullptr){
 
 		entries.clear();
 #ifdef ENABLE_CACHE
-		if(total <= topCache.size()){
+		if(total <= topCache.size() && histogram == nullptr && table == nullptr){
 			//pull from cache
+			KMER_STATS_ADD(TopCacheHits, 1);
 			entries.reserve(total);
 			auto it = topCache.begin();
-			for(auto i = 0; i < total; i++){
+			for(auto i = 0; i < total && it->second >= minValueFilter; i++){
 				entries.push_back(*it);
 				it++;
 			};
@@ -60,52 +136,36 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 			return KmerError();
 		}
 #endif
-		std::list<EntryType> temp;
-
-		kyotocabinet::DB::Cursor * cur = db.cursor();
+		KMER_STATS_ADD(TopCacheMisses, 1);
+		KMER_STATS_SCOPE(TopScan);
 
-		cur->jump();
+		Selector selector(total);
 
-		datum key, data;
-		loadNextEntry(cur, key, data);
+		KmerError err = scanRecords([this, &selector, minValueFilter, histogram, table](datum & key, datum & data){
 
-		KmerError err;
+			//only keys that can still make it in get decoded
+			CounterType count = getCountFromDatum(data);
+			if(histogram) histogram->add(count);
+			if(table && count >= minValueFilter) table->add(key.dptr, key.dsize, count);
+			if(count >= minValueFilter && selector.isCandidate(count))
+				selector.offer(getKeyFromDatum(key), count);
 
-		while (key.dptr!=nullptr){
+		});
+		if(err.isError()) return err;
 
-
-			err = updateTopCache(key, data, temp, total, false);
-			if(err.isError()) return err;
-
-			delete key.dptr; key.dptr = nullptr;
-			delete data.dptr; data.dptr = nullptr;
-			loadNextEntry(cur, key, data);
-
-		}
-
-		std::cout << "Top keys got:" << temp.size() << " keys" << std::endl;
-
-		delete cur; delete key.dptr; delete data.dptr;
-
-		auto sortFunction = [](const EntryType & first, const EntryType & second){ return first.second > second.second;};
-		if(temp.size() != total){
-			//need to sort, sort hasn't been called yet
-			temp.sort(sortFunction);
-		}
-
-		//copy to rtn vector
-		entries.reserve(temp.size());
-		for(auto & i : temp){
-			entries.push_back(i);
-		}
+		selector.getSorted(entries);
 
 		return KmerError();
 	}
 
 
-	KmerError incrementKey(EntryType key){
+	//minNewCount drops keys the database hasn't seen yet if their count is below it. Only safe on the
+	//last flush, when nothing can be added to them later, and only for scratch databases: a kept one
+	//may be appended to by later runs.
+	KmerError incrementKey(EntryType key, CounterType minNewCount = 0){
 
 		auto dKey = createDatum(key);
+		dKey.second = createCountDatum(key.second);
 
 		auto checkRtn = db.check(dKey.first.dptr,dKey.first.dsize);
 
@@ -113,6 +173,20 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 
 		if(checkRtn==-1){
 
+			if(key.second < minNewCount && cleanUp){
+				skippedBelowMin++;
+				skippedBelowMinBytes += dKey.first.dsize + dKey.second.dsize + recordOverhead;
+				return err;
+			}
+
+			//Every so often make sure the next batch of new records still fits, updates don't grow the file
+			if(diskLimit && ++addsSinceCheck >= diskCheckInterval){
+				addsSinceCheck = 0;
+				size_t onDisk = (size_t)db.size() + getTransactionLogSize();
+				if(onDisk + diskCheckInterval * (dKey.first.dsize + sizeof(CounterType) + recordOverhead) > diskLimit)
+					return KmerError(1, "Database " + cacheName + " would exceed the disk limit of " + std::to_string(diskLimit / (1024 * 1024)) + " MB (currently " + std::to_string(onDisk / (1024 * 1024)) + " MB)");
+			}
+
 			if(!db.add(dKey.first.dptr, dKey.first.dsize, dKey.second.dptr, dKey.second.dsize))
 				return KmerError(1, "Error when adding key");
 
@@ -131,23 +205,24 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 			if(current.dptr == nullptr)
 				return KmerError(2, "Failure during fetch. Odd, GDBM said this entry existed.");
 
-			CounterType * cPtr = (CounterType *)current.dptr;
+			CounterType count = getCountFromDatum(current);
+			delete[] current.dptr;
 
 			//add this counter, but don't allow overflows
-			if(std::numeric_limits<CounterType>::max() - *cPtr > key.second)//no overflow
-				*cPtr += key.second;
+			if(std::numeric_limits<CounterType>::max() - count > key.second)//no overflow
+				count += key.second;
 			else //overflow will happen
-				*cPtr = std::numeric_limits<CounterType>::max();
+				count = std::numeric_limits<CounterType>::max();
+
+			auto updated = createCountDatum(count);
 
-			if(!db.set(dKey.first.dptr, dKey.first.dsize, current.dptr, current.dsize))
+			if(!db.set(dKey.first.dptr, dKey.first.dsize, updated.dptr, updated.dsize))
 				err = KmerError(1, "Error when updating key ");
 
 #ifdef ENABLE_CACHE
-			err |= updateTopCache(dKey.first, current, topCache, topCacheSize);
+			err |= updateTopCache(dKey.first, updated, topCache, topCacheSize);
 #endif
 
-			delete current.dptr;
-
 		}
 
 
@@ -162,15 +237,219 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 	std::string cacheName;
 	kyotocabinet::HashDB db;
 	bool cleanUp;
+	size_t mapSize;
+	bool compactCounts;
+	OpenMode mode;
+	KeyCacheHeader header;
+	bool priorRecords;
+	bool inTransaction;
+	size_t diskLimit;
+	size_t addsSinceCheck;
+	size_t skippedBelowMin;
+	size_t skippedBelowMinBytes;
+
+	//New records between disk limit checks, and a generous estimate of Kyoto's per record overhead
+	static const size_t diskCheckInterval = 4096;
+	static const size_t recordOverhead = 32;
+
 	struct datum{
 		char * dptr;
 		size_t dsize;
 	};
 
+	CounterType countBuffer;
+
+	//Record values are either a single byte (compact counts) or a full counter. Databases kept by a run
+	//with narrower counters can be read back too, the value is taken as a little endian number of its size.
+	CounterType getCountFromDatum(datum & data){
+
+		if(data.dsize == 1)
+			return (unsigned char)data.dptr[0];
+
+		if(data.dsize == sizeof(CounterType)){
+			CounterType c;
+			memcpy(&c, data.dptr, sizeof(CounterType));
+			return c;
+		}
+
+		CounterType c = 0;
+		for(size_t i = std::min(data.dsize, sizeof(CounterType)); i-- > 0;)
+			c = (CounterType)(c << 8) | (unsigned char)data.dptr[i];
+
+		return c;
+
+	};
+
+	datum createCountDatum(CounterType count){
+
+		datum rtn;
+		countBuffer = count;
+
+		if(compactCounts && count < std::numeric_limits<unsigned char>::max()){
+			unsigned char small = (unsigned char)count;
+			memcpy(&countBuffer, &small, 1);
+			rtn.dsize = 1;
+		}
+		else
+			rtn.dsize = sizeof(CounterType);
+
+		rtn.dptr = (char *)&countBuffer;
+		return rtn;
+
+	};
+
 	virtual KeyType getKeyFromDatum(datum & data) = 0;
 	virtual std::pair<datum, datum> createDatum(EntryType & input) = 0;
 
 	public:
+
+	//Bytes taken by the database file
+	size_t getDatabaseSize(){
+		return db.size();
+	};
+
+	//Bytes of the write-ahead log Kyoto keeps next to the file while a checkpoint transaction is open
+	size_t getTransactionLogSize(){
+
+		if(!inTransaction)
+			return 0;
+
+		struct stat info;
+		return stat((cacheName + ".wal").c_str(), &info) == 0 ? (size_t)info.st_size : 0;
+
+	};
+
+	//Largest part of the file Kyoto keeps memory mapped
+	size_t getMapSize(){
+		return mapSize;
+	};
+
+	size_t getTopCacheSize(){
+		return topCache.size();
+	};
+
+	//Read only pass handing every record's packed key and count to onRecord(const char * key, size_t keyBytes, CounterType count)
+	template <class F> KmerError scanCounts(F onRecord){
+
+		return scanRecords([this, &onRecord](datum & key, datum & data){
+			onRecord((const char *)key.dptr, key.dsize, getCountFromDatum(data));
+		});
+
+	};
+
+	size_t getRecordCount(){
+		return db.count();
+	};
+
+	//Counter width recorded in the header
+	size_t getCountBytes(){
+		return header.countBytes;
+	};
+
+	//k recorded in the header, 0 when it wasn't known
+	size_t getKmerWidth(){
+		return header.kmerWidth;
+	};
+
+	//True when the database was opened with the records of earlier runs in it
+	bool hasPriorRecords(){
+		return priorRecords;
+	};
+
+	//From here on changes are made in a Kyoto transaction, committed by each checkpoint(). A run that dies
+	//in between reopens the database as of its last checkpoint, Kyoto rolls the rest back.
+	KmerError beginCheckpoints(){
+
+		if(!db.begin_transaction(false))
+			return KmerError(1, "Unable to start a transaction on database " + cacheName);
+
+		inTransaction = true;
+		return KmerError();
+
+	};
+
+	//Commits everything added since the last checkpoint as the given generation, syncs it to disk and
+	//saves the top cache next to the database, tagged with the same generation.
+	KmerError checkpoint(uint32_t generation){
+
+		//written first, a sidecar newer than the database is ignored when it's reopened
+		header.checkpoint = generation;
+		saveTopCache();
+
+		memcpy(db.opaque(), &header, sizeof(header));
+		if(!db.synchronize_opaque())
+			return KmerError(1, "Unable to write the header of database " + cacheName);
+
+		if(inTransaction && !db.end_transaction(true))
+			return KmerError(1, "Unable to commit database " + cacheName);
+		inTransaction = false;
+
+		if(!db.synchronize(true))
+			return KmerError(1, "Unable to sync database " + cacheName);
+
+		return beginCheckpoints();
+
+	};
+
+	//Generation of the last checkpoint committed to the database
+	uint32_t getCheckpoint(){
+		return header.checkpoint;
+	};
+
+	//Removes the database and its top cache when it's closed, like a scratch database
+	void removeOnClose(){
+		cleanUp = true;
+	};
+
+	//Keys incrementKey dropped for being below minNewCount, and roughly how much database they would have taken
+	size_t getSkippedBelowMin(){
+		return skippedBelowMin;
+	};
+
+	size_t getSkippedBelowMinBytes(){
+		return skippedBelowMinBytes;
+	};
+
+	//Fills in the count of every entry's key, 0 for keys that aren't there. Values are read in place
+	//through a visitor rather than copied out. Sorting the batch beforehand keeps equal keys together.
+	KmerError getCounts(std::vector<EntryType> & entries){
+
+		class CountVisitor : public kyotocabinet::DB::Visitor {
+		public:
+			CountVisitor(BaseKeyCache & _cache) :cache(_cache), count(0) {};
+			const char * visit_full(const char *, size_t, const char * vbuf, size_t vsiz, size_t *){
+				datum data;
+				data.dptr = const_cast<char *>(vbuf); data.dsize = vsiz;
+				count = cache.getCountFromDatum(data);
+				return NOP;
+			};
+			BaseKeyCache & cache;
+			CounterType count;
+		};
+
+		CountVisitor visitor(*this);
+
+		for(auto & i : entries){
+
+			visitor.count = 0;
+			auto dKey = createDatum(i);
+
+			if(!db.accept(dKey.first.dptr, dKey.first.dsize, &visitor, false))
+				return KmerError(1, "Error while looking up key");
+
+			i.second = visitor.count;
+
+		}
+
+		return KmerError();
+
+	};
+
+	//incrementKey fails before adding records that could push the file past diskLimit bytes. 0 disables the check.
+	void setDiskLimit(size_t bytes){
+		diskLimit = bytes;
+	};
+
 	void dumpAllKeys(){
 
 		kyotocabinet::DB::Cursor * cur = db.cursor();
@@ -187,22 +466,22 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 
 			KeyType k = getKeyFromDatum(key);
 
-			CounterType * c = (CounterType *)data.dptr;
+			CounterType c = getCountFromDatum(data);
 
 			for(auto & i : k)
 				std::cout << +i << ",";
 
-			std::cout << " = " << +*c << std::endl;
+			std::cout << " = " << +c << std::endl;
 
 
-			delete key.dptr; key.dptr = nullptr;
-			delete data.dptr; data.dptr = nullptr;
+			delete[] key.dptr; key.dptr = nullptr;
+			delete[] data.dptr; data.dptr = nullptr;
 			loadNextEntry(cur, key, data);
 
 		};
 
-		delete key.dptr;
-		delete data.dptr;
+		delete[] key.dptr;
+		delete[] data.dptr;
 
 		delete cur;
 
@@ -213,64 +492,219 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 	protected:
 
 
+	typedef TopSelector<KeyType, CounterType, KeyCodec::Less<KeyType>> Selector;
+
+	//Kept in Selector order, so it holds exactly the top entries a full scan would select
 	std::list<EntryType> topCache;
 
+	//Counts only grow, so an entry only ever moves up: reposition it if it's cached, otherwise insert
+	//it if it now ranks ahead of the last cached entry.
 	KmerError updateTopCache(datum & key, datum & data, std::list<EntryType> & temp, size_t total, bool verbose = false){
 
-		auto sortFunction = [](const EntryType & first, const EntryType & second){ return first.second > second.second;};
-
+		CounterType c = getCountFromDatum(data);
 
-		CounterType c = *((CounterType *)data.dptr);
+		//can't get in, don't bother decoding the key
+		if(temp.size() >= total && c < temp.back().second)
+			return KmerError();
 
-		KeyType k = getKeyFromDatum(key);
+		EntryType entry(getKeyFromDatum(key), c);
 
-		if(temp.size()==0){
-			//Cache is empty, just add it
-			if(verbose) std::cout << "Cache primed" << std::endl;
-			temp.push_back(std::make_pair(k,c));
+		if(temp.size() >= total && !Selector::ranksBefore(entry, temp.back()))
 			return KmerError();
-		};
 
-		if(c > temp.back().second || temp.size() < total){
+		if(&temp == &topCache)
+			KMER_STATS_ADD(TopCacheUpdates, 1);
+
+		if(verbose)
+			std::cout << "Updating... count = " << +c << " current size = " << temp.size() << " total = " << total << std::endl;
+
+		for(auto i = temp.begin(); i != temp.end(); i++){
+			if(i->first == entry.first){
+				temp.erase(i);
+				break;
+			}
+		}
 
-			if(verbose)
-				std::cout << "Updating... key = " << k[0] << " count = " << +c << " current size = " << temp.size() << " total = " << total << std::endl;
+		auto nextPos = temp.begin();
+		while(nextPos != temp.end() && Selector::ranksBefore(*nextPos, entry))
+			nextPos++;
 
-			auto currentPos = temp.end();
-			auto nextPos = temp.end();
-			bool found = false;
-			for(auto i = temp.begin(); i != temp.end(); i++){
+		temp.insert(nextPos, entry);
 
-				if(c > i->second && !found){
-					nextPos = i;
-					found = true;
-				};
+		while(temp.size() > total) temp.pop_back();
 
+		return KmerError();
 
-				if(i->first == k){
-					//Found my current entry. Flag, move on to next
-					currentPos = i;
-					break;
-				};
+	};
 
+	//Read only pass over every record. Kyoto hands the visitor pointers into its own buffers,
+	//so unlike a cursor nothing is copied or allocated per record.
+	template <class F> KmerError scanRecords(F onRecord){
+
+		class ScanVisitor : public kyotocabinet::DB::Visitor {
+		public:
+			ScanVisitor(F & _onRecord) :onRecord(_onRecord) {};
+			const char * visit_full(const char * kbuf, size_t ksiz, const char * vbuf, size_t vsiz, size_t *){
+				datum key, data;
+				key.dptr = const_cast<char *>(kbuf); key.dsize = ksiz;
+				data.dptr = const_cast<char *>(vbuf); data.dsize = vsiz;
+				onRecord(key, data);
+				return NOP;
 			};
+		private:
+			F & onRecord;
+		};
+
+		ScanVisitor visitor(onRecord);
 
-			temp.insert(nextPos, std::make_pair(k,c));
+		if(!db.iterate(&visitor, false))
+			return KmerError(1, "Error while scanning database");
 
-			if(currentPos!=temp.end())
-				temp.erase(currentPos);
+		return KmerError();
 
+	};
 
-			while(temp.size() > total) temp.pop_back();
+	static bool fileExists(std::string path){
+		std::ifstream in(path.c_str(), std::ios_base::binary);
+		return in.is_open();
+	};
 
-		};
+	KmerError checkHeader(size_t kmerWidth){
 
+		if(memcmp(header.magic, KeyCacheHeader::getMagic(), sizeof(header.magic)) != 0)
+			return KmerError(1, cacheName + " is not a kmer count database");
+
+		if(header.version != KeyCacheHeader::currentVersion || header.encoding != KeyCacheHeader::keyCodecEncoding)
+			return KmerError(1, "Database " + cacheName + " has an unsupported version or key encoding");
+
+		if(kmerWidth && header.kmerWidth != kmerWidth)
+			return KmerError(1, "Database " + cacheName + " holds " + std::to_string(header.kmerWidth) + "-mers, not " + std::to_string(kmerWidth) + "-mers");
+
+		//reading only needs the counts to fit, adding to them needs the same saturation point
+		if(mode == Append ? header.countBytes != sizeof(CounterType) : header.countBytes > sizeof(CounterType))
+			return KmerError(1, "Database " + cacheName + " holds " + std::to_string(header.countBytes) + " byte counts, not " + std::to_string(sizeof(CounterType)));
 
 		return KmerError();
 
 	};
 
+	//The top cache of a kept database is saved next to it, so appending doesn't have to scan the
+	//records of earlier runs to rebuild it.
+	std::string getTopCachePath(){
+		return cacheName + ".top";
+	};
+
+	//Called by KeyCache once it can unpack keys. The sidecar is removed as it's loaded, so a run that
+	//doesn't finish leaves none behind and the next append rebuilds the cache from the records instead
+	//of trusting a stale one.
+	void openTopCache(){
+
+		if(mode != Append || !priorRecords)
+			return;
+
+		std::string path = getTopCachePath();
+		std::ifstream in(path.c_str(), std::ios_base::binary);
+
+		char magic[8] = {0};
+		uint64_t capacity = 0, entries = 0;
+		in.read(magic, sizeof(magic));
+		in.read((char *)&capacity, sizeof(capacity));
+		in.read((char *)&entries, sizeof(entries));
+
+		uint32_t generation = 0;
+		in.read((char *)&generation, sizeof(generation));
+
+		//a smaller saved cache isn't known to hold the top entries of a bigger one, and one saved
+		//for another checkpoint doesn't match the records
+		bool usable = in && memcmp(magic, "KMTOPC2", 8) == 0 && capacity >= topCacheSize && generation == header.checkpoint;
+
+		std::list<EntryType> loaded;
+		std::vector<char> keyBuffer;
+
+		for(uint64_t i = 0; usable && i < entries; i++){
+
+			uint32_t keyBytes = 0;
+			uint64_t count = 0;
+			in.read((char *)&keyBytes, sizeof(keyBytes));
+			keyBuffer.resize(keyBytes);
+			in.read(keyBuffer.data(), keyBytes);
+			in.read((char *)&count, sizeof(count));
+
+			if(!in){
+				usable = false;
+				break;
+			}
+
+			datum key;
+			key.dptr = keyBuffer.data(); key.dsize = keyBytes;
+			if(loaded.size() < topCacheSize)
+				loaded.emplace_back(getKeyFromDatum(key), (CounterType)count);
+
+		}
+
+		in.close();
+		remove(path.c_str());
+
+		if(usable){
+			topCache.swap(loaded);
+			return;
+		}
+
+		Selector selector(topCacheSize);
+		KmerError err = scanRecords([this, &selector](datum & key, datum & data){
+			CounterType count = getCountFromDatum(data);
+			if(selector.isCandidate(count))
+				selector.offer(getKeyFromDatum(key), count);
+		});
+		if(err.isError()) throw err;
+
+		std::vector<EntryType> sorted;
+		selector.getSorted(sorted);
+		topCache.assign(sorted.begin(), sorted.end());
+
+	};
+
+	//Called by KeyCache on the way out. Failing to save only costs the next append a scan. Between
+	//checkpoints the cache holds counts that are about to be rolled back, the last checkpoint saved it.
+	void closeTopCache(){
+
+		if(cleanUp || mode == Read || inTransaction)
+			return;
+
+		saveTopCache();
+
+	};
+
+	void saveTopCache(){
+
+		std::string path = getTopCachePath();
+		std::ofstream out((path + ".tmp").c_str(), std::ios_base::binary);
+
+		uint64_t capacity = topCacheSize, entries = topCache.size();
+		uint32_t generation = header.checkpoint;
+		out.write("KMTOPC2", 8);
+		out.write((const char *)&capacity, sizeof(capacity));
+		out.write((const char *)&entries, sizeof(entries));
+		out.write((const char *)&generation, sizeof(generation));
+
+		for(auto & i : topCache){
+			auto dKey = createDatum(i);
+			uint32_t keyBytes = dKey.first.dsize;
+			uint64_t count = i.second;
+			out.write((const char *)&keyBytes, sizeof(keyBytes));
+			out.write(dKey.first.dptr, keyBytes);
+			out.write((const char *)&count, sizeof(count));
+		}
+
+		out.close();
+
+		if(out.fail() || rename((path + ".tmp").c_str(), path.c_str()) != 0)
+			remove((path + ".tmp").c_str());
+
+	};
+
 	void loadNextEntry(kyotocabinet::DB::Cursor * cur, datum & key, datum & data){
+		data.dptr = nullptr;
 		key.dptr = cur->get_key(&key.dsize, false);
 		if(key.dptr!=nullptr)
 			data.dptr = cur->get_value(&data.dsize, true);
@@ -279,21 +713,25 @@ template <class KeyType, typename CounterType> class BaseKeyCache{
 
 	virtual ~BaseKeyCache(){
 
+		//a run that fails between checkpoints leaves the database as of the last one, so it can be resumed.
+		//Finished runs commit with a final checkpoint.
+		if(inTransaction)
+			db.end_transaction(false);
+
 		//close cache
 		db.close();
 
-		//now delete database
-		if(cleanUp)
+		//now delete database, and the top cache a checkpoint saved next to it
+		if(cleanUp){
 			remove(cacheName.c_str());
+			remove(getTopCachePath().c_str());
+		}
 
 	};
 
 };
 
 
-//TODO: Remove cacheName as input parameter, have it autogenerated using a unique ID.
-//Right now the application uses the same name for its temporary files, which
-//could be bad when trying to run multiple instances.
 template <class KeyType, typename CounterType> class KeyCache : public BaseKeyCache<KeyType, CounterType>{
 
 	typedef typename BaseKeyCache<KeyType, CounterType>::datum datum;
@@ -301,7 +739,7 @@ template <class KeyType, typename CounterType> class KeyCache : public BaseKeyCa
 
 	public:
 	typedef std::pair<KeyType, CounterType> EntryType;
-	KeyCache(std::string cacheName, bool cleanUp=false, size_t topCache=100);
+	KeyCache(std::string cacheName, bool cleanUp=false, size_t topCache=100, size_t mapSize=BaseKeyCache<KeyType, CounterType>::defaultMapSize(), bool compactCounts=false, size_t kmerWidth=0, typename BaseKeyCache<KeyType, CounterType>::OpenMode mode=BaseKeyCache<KeyType, CounterType>::Create);
 
 	~KeyCache();
 
@@ -321,7 +759,7 @@ template <class KeyType, typename CounterType> class KeyCache : public BaseKeyCa
 };
 
 //array type
-template<> template <typename KeyT, size_t Nkeys, typename CounterT> class KeyCache<std::array<KeyT, Nkeys>, CounterT> : public BaseKeyCache<std::array<KeyT, Nkeys>, CounterT>{
+template <typename KeyT, size_t Nkeys, typename CounterT> class KeyCache<std::array<KeyT, Nkeys>, CounterT> : public BaseKeyCache<std::array<KeyT, Nkeys>, CounterT>{
 
 	//ensure key using unsigned counters and key types
 	static_assert(std::is_unsigned<KeyT>::value == true, "KeyCache array key precision should be unsigned.");
@@ -338,17 +776,25 @@ template<> template <typename KeyT, size_t Nkeys, typename CounterT> class KeyCa
 
 	//typedef datum KeyCache<std:;array<KeyT, NKeys>>::datum;
 
-	KeyCache(std::string _cacheName, bool _cleanUp=true, size_t _topCacheSize=100):BaseKeyCache<std::array<KeyT, Nkeys>, CounterT>(_cacheName,_cleanUp, _topCacheSize){};
+	//Keys are stored packed (see KeyCodec) when the kmer width is known, otherwise as the raw registers
+	KeyCache(std::string _cacheName, bool _cleanUp=true, size_t _topCacheSize=100, size_t _mapSize=BaseKeyCache<std::array<KeyT, Nkeys>, CounterT>::defaultMapSize(), bool _compactCounts=false, size_t _kmerWidth=0, typename BaseKeyCache<std::array<KeyT, Nkeys>, CounterT>::OpenMode _mode=BaseKeyCache<std::array<KeyT, Nkeys>, CounterT>::Create):BaseKeyCache<std::array<KeyT, Nkeys>, CounterT>(_cacheName,_cleanUp, _topCacheSize, _mapSize, _compactCounts, _kmerWidth, _mode){
+
+		keyBytes = sizeof(KeyPrecision) * Nkeys;
+		if(_kmerWidth)
+			keyBytes = std::min(keyBytes, KeyCodec::packedBytes(_kmerWidth));
+
+		this->openTopCache();
+
+	};
 
-	~KeyCache(){}
+	~KeyCache(){
+		this->closeTopCache();
+	}
 
 	protected:
 	KeyType getKeyFromDatum(datum & data){
 		KeyType k;
-		KeyPrecision * kPtr = (KeyPrecision *)data.dptr;
-		for(auto i = 0; i < k.size(); i++)
-			k[i] = kPtr[i];
-
+		KeyCodec::unpack((unsigned char *)data.dptr, data.dsize, k);
 		return k;
 
 	};
@@ -356,8 +802,9 @@ template<> template <typename KeyT, size_t Nkeys, typename CounterT> class KeyCa
 	std::pair<datum, datum> createDatum(EntryType & input){
 
 		std::pair<datum,datum> rtn;
-		rtn.first.dptr = (char *)input.first.data();
-		rtn.first.dsize = sizeof(KeyPrecision) * input.first.size();
+		KeyCodec::pack(input.first, keyBytes, keyBuffer.data());
+		rtn.first.dptr = (char *)keyBuffer.data();
+		rtn.first.dsize = keyBytes;
 
 		rtn.second.dsize = sizeof(CounterType);
 		rtn.second.dptr = (char *)&input.second;
@@ -366,11 +813,14 @@ template<> template <typename KeyT, size_t Nkeys, typename CounterT> class KeyCa
 
 	}
 
+	private:
 
+	size_t keyBytes;
+	std::array<unsigned char, sizeof(KeyPrecision) * Nkeys> keyBuffer;
 
 };
 
-template<> template <typename CounterT> class KeyCache<std::vector<char>, CounterT> : public BaseKeyCache<std::vector<char>, CounterT>{
+template <typename CounterT> class KeyCache<std::vector<char>, CounterT> : public BaseKeyCache<std::vector<char>, CounterT>{
 
 	typedef typename BaseKeyCache<std::vector<char>, CounterT>::datum datum;
 
@@ -385,13 +835,28 @@ template<> template <typename CounterT> class KeyCache<std::vector<char>, Counte
 	typedef std::pair<KeyType, CounterType> EntryType;
 
 
-	KeyCache(std::string _cacheName, bool _cleanUp=true, size_t _topCacheSize=100):BaseKeyCache<std::vector<char>, CounterT>(_cacheName,_cleanUp, _topCacheSize){};
+	//Keys are stored packed at 3 bits per base (see KeyCodec) when the kmer width is known, otherwise a byte per base
+	KeyCache(std::string _cacheName, bool _cleanUp=true, size_t _topCacheSize=100, size_t _mapSize=BaseKeyCache<std::vector<char>, CounterT>::defaultMapSize(), bool _compactCounts=false, size_t _kmerWidth=0, typename BaseKeyCache<std::vector<char>, CounterT>::OpenMode _mode=BaseKeyCache<std::vector<char>, CounterT>::Create):BaseKeyCache<std::vector<char>, CounterT>(_cacheName,_cleanUp, _topCacheSize, _mapSize, _compactCounts, _kmerWidth, _mode),kmerWidth(_kmerWidth){
+
+		keyBuffer.resize(KeyCodec::packedBytes(kmerWidth));
 
-	~KeyCache(){}
+		this->openTopCache();
+
+	};
+
+	~KeyCache(){
+		this->closeTopCache();
+	}
 
 	protected:
 	KeyType getKeyFromDatum(datum & data){
 		KeyType k;
+
+		if(kmerWidth){
+			KeyCodec::unpack((unsigned char *)data.dptr, kmerWidth, k);
+			return k;
+		}
+
 		KeyPrecision * kPtr = (KeyPrecision *)data.dptr; k.resize(data.dsize);
 		for(auto i = 0; i < k.size(); i++)
 			k[i] = kPtr[i];
@@ -403,8 +868,16 @@ template<> template <typename CounterT> class KeyCache<std::vector<char>, Counte
 	std::pair<datum, datum> createDatum(EntryType & input){
 
 		std::pair<datum,datum> rtn;
-		rtn.first.dptr = (char *)input.first.data();
-		rtn.first.dsize = sizeof(KeyPrecision) * input.first.size();
+
+		if(kmerWidth){
+			KeyCodec::pack(input.first, keyBuffer.data());
+			rtn.first.dptr = (char *)keyBuffer.data();
+			rtn.first.dsize = keyBuffer.size();
+		}
+		else{
+			rtn.first.dptr = (char *)input.first.data();
+			rtn.first.dsize = sizeof(KeyPrecision) * input.first.size();
+		}
 
 		rtn.second.dsize = sizeof(CounterType);
 		rtn.second.dptr = (char *)&input.second;
@@ -413,5 +886,9 @@ template<> template <typename CounterT> class KeyCache<std::vector<char>, Counte
 
 	}
 
+	private:
+
+	size_t kmerWidth;
+	std::vector<unsigned char> keyBuffer;
 
 };
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+//Packed on-disk representation of a kmer, shared by every key type so that keys written by
+//different counters (and by the array and vector merizers) are byte for byte identical.
+//
+//Bases are stored 3 bits apiece (enough for GTACN) with the last base of the kmer in the lowest bits,
+//which is the bit order the array Merizer already uses for its tokens. Bytes are little endian and
+//only ceil(3 * kmerWidth / 8) of them are stored, instead of the full register width or a byte per base.
+namespace KeyCodec {
+
+	const size_t bitsPerBase = 3;
+
+	inline size_t packedBytes(size_t kmerWidth) {
+		return (kmerWidth * bitsPerBase + 7) / 8;
+	}
+
+	//Orders packed keys as the little endian numbers they are. For keys of the same width that's the
+	//lexicographic order of their encoded sequences, since the first base sits in the highest bits.
+	inline int compare(const unsigned char * a, const unsigned char * b, size_t bytes) {
+
+		for (size_t i = bytes; i-- > 0;)
+			if (a[i] != b[i])
+				return a[i] < b[i] ? -1 : 1;
+
+		return 0;
+
+	}
+
+	//FNV-1a over the packed form, so a kmer hashes the same whatever key type holds it. Used to split
+	//the kmer space into partitions between merge threads.
+	inline uint64_t hash(const unsigned char * key, size_t bytes) {
+
+		uint64_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < bytes; i++) {
+			h ^= key[i];
+			h *= 1099511628211ULL;
+		}
+
+		return h;
+
+	}
+
+	//Orders keys of any type the way their packed form sorts, so ties in the top kmers come out the same
+	//from every counter, the count table and a merge. Encoded sequences already compare that way; array
+	//tokens have to be compared from their most significant register down.
+	template <class K> struct Less {
+		bool operator()(const K & a, const K & b) const {
+			return a < b;
+		}
+	};
+
+	template <typename T, size_t N> struct Less<std::array<T, N>> {
+		bool operator()(const std::array<T, N> & a, const std::array<T, N> & b) const {
+			for (size_t i = N; i-- > 0;)
+				if (a[i] != b[i])
+					return a[i] < b[i];
+			return false;
+		}
+	};
+
+	//Array tokens are already a contiguous bit stream over their registers, so packing only drops the unused high bytes
+	template <typename T, size_t N> void pack(const std::array<T, N> & key, size_t bytes, unsigned char * out) {
+
+		for (size_t i = 0; i < bytes; i++)
+			out[i] = (unsigned char)(key[i / sizeof(T)] >> (8 * (i % sizeof(T))));
+
+	}
+
+	template <typename T, size_t N> void unpack(const unsigned char * in, size_t bytes, std::array<T, N> & key) {
+
+		key.fill(0);
+
+		for (size_t i = 0; i < bytes && i < N * sizeof(T); i++)
+			key[i / sizeof(T)] |= (T)in[i] << (8 * (i % sizeof(T)));
+
+	}
+
+	//Encoded sequences (one 0-4 value per base), as used by the vector Merizer
+	inline void pack(const std::vector<char> & sequence, unsigned char * out) {
+
+		size_t bytes = packedBytes(sequence.size());
+		for (size_t i = 0; i < bytes; i++)
+			out[i] = 0;
+
+		for (size_t i = 0; i < sequence.size(); i++) {
+
+			size_t bit = (sequence.size() - 1 - i) * bitsPerBase;
+			unsigned value = (unsigned char)sequence[i] << (bit % 8);
+
+			out[bit / 8] |= (unsigned char)value;
+			if (value > 0xff)
+				out[bit / 8 + 1] |= (unsigned char)(value >> 8);
+
+		}
+
+	}
+
+	inline void unpack(const unsigned char * in, size_t kmerWidth, std::vector<char> & sequence) {
+
+		sequence.resize(kmerWidth);
+
+		for (size_t i = 0; i < kmerWidth; i++) {
+
+			size_t bit = (kmerWidth - 1 - i) * bitsPerBase;
+			unsigned value = in[bit / 8] >> (bit % 8);
+			if (bit % 8 > 8 - bitsPerBase)
+				value |= (unsigned)in[bit / 8 + 1] << (8 - bit % 8);
+
+			sequence[i] = value & ((1 << bitsPerBase) - 1);
+
+		}
+
+	}
+
+};
@@ -0,0 +1,326 @@
+#include "kmerCounter.h"
+#include "kmerUtils.h"
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <sstream>
+
+using namespace KmerUtils;
+using namespace std;
+
+//Microbenchmarks for the building blocks of kmerCounter: sequence encoding, the Merizer specializations,
+//each counter's addSequence and the database's incrementKey/getTopKeys. Results are written as JSON so
+//they can be kept and compared between releases.
+//
+//Usage: kmerBench [--out results.json] [--min-time seconds] [--filter substring]
+
+struct BenchConfig {
+	double minTime;
+	string filter;
+};
+
+struct BenchResult {
+	string name;
+	vector<pair<string, string>> params;
+	size_t iterations;
+	double seconds;
+	size_t itemsPerIteration;
+};
+
+static vector<BenchResult> results;
+
+//Runs f until minTime has passed (at least once) and records the rate. items is the work done per call, e.g. kmers or bases.
+template <class F> void runBenchmark(BenchConfig & config, string name, vector<pair<string, string>> params, size_t items, F f) {
+
+	string fullName = name;
+	for (auto & i : params)
+		fullName += "/" + i.first + ":" + i.second;
+
+	if (config.filter.size() && fullName.find(config.filter) == string::npos)
+		return;
+
+	BenchResult result;
+	result.name = name;
+	result.params = params;
+	result.itemsPerIteration = items;
+	result.iterations = 0;
+
+	auto start = chrono::steady_clock::now();
+	double elapsed = 0;
+
+	do {
+		f();
+		result.iterations++;
+		elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	} while (elapsed < config.minTime);
+
+	result.seconds = elapsed;
+	results.push_back(result);
+
+	cerr << fullName << " : " << result.iterations * items / elapsed / 1e6 << " M items/s" << endl;
+
+}
+
+//Random GTAC reads with a sprinkling of N, same seed every run
+static vector<string> makeReads(size_t count, size_t length) {
+
+	mt19937_64 rng(42);
+	const char bases[] = "GTACN";
+	uniform_int_distribution<int> base(0, 3);
+	uniform_int_distribution<int> rare(0, 999);
+
+	vector<string> reads(count);
+
+	for (auto & read : reads) {
+		read.resize(length);
+		for (auto & c : read)
+			c = rare(rng) == 0 ? bases[4] : bases[base(rng)];
+	}
+
+	return reads;
+
+}
+
+static vector<pair<string, string>> describe(size_t kmerWidth, size_t readLength) {
+	return { make_pair("k", to_string(kmerWidth)), make_pair("readLength", to_string(readLength)) };
+}
+
+template <class T> void benchMerizer(BenchConfig & config, string typeName, size_t kmerWidth, size_t readLength) {
+
+	auto reads = makeReads(64, readLength);
+	vector<vector<char>> encoded(reads.size());
+	for (size_t i = 0; i < reads.size(); i++)
+		KmerCounter<>::encodeSequence(reads[i], encoded[i]);
+
+	Merizer<T> merizer(kmerWidth);
+	size_t kmersPerRead = readLength - kmerWidth + 1;
+
+	auto params = describe(kmerWidth, readLength);
+	params.push_back(make_pair("key", typeName));
+
+	size_t next = 0;
+	runBenchmark(config, "Merizer::getMerTokens", params, kmersPerRead, [&]() {
+		auto tokens = merizer.getMerTokens(encoded[next++ % encoded.size()]);
+		if (tokens.size() != kmersPerRead) throw KmerError(1, "Unexpected token count");
+	});
+
+	auto tokens = merizer.getMerTokens(encoded[0]);
+	runBenchmark(config, "Merizer::tokenToSequence", params, 1, [&]() {
+		auto seq = merizer.tokenToSequence(tokens[next++ % tokens.size()]);
+		if (seq.size() != kmerWidth) throw KmerError(1, "Unexpected sequence length");
+	});
+
+}
+
+template <class Counter> void benchCounter(BenchConfig & config, string counterName, string precision, size_t kmerWidth, size_t readLength) {
+
+	auto reads = makeReads(1024, readLength);
+	size_t kmersPerRead = readLength - kmerWidth + 1;
+
+	auto params = describe(kmerWidth, readLength);
+	params.push_back(make_pair("counter", counterName));
+	params.push_back(make_pair("precision", precision));
+
+	Counter counter(kmerWidth);
+
+	size_t next = 0;
+	runBenchmark(config, "KmerCounter::addSequence", params, kmersPerRead, [&]() {
+		auto err = counter.addSequence(reads[next++ % reads.size()]);
+		if (err.isError()) throw err;
+	});
+
+}
+
+//Every key type kmerCounter picks for some k (see withCounterType) that can hold kmerWidth, plus the bitset Merizer
+static void benchMerizers(BenchConfig & config, size_t kmerWidth, size_t readLength) {
+
+	if (kmerWidth < 3)
+		benchMerizer<std::array<unsigned char, 1>>(config, "uint8x1", kmerWidth, readLength);
+	if (kmerWidth < 6)
+		benchMerizer<std::array<unsigned short, 1>>(config, "uint16x1", kmerWidth, readLength);
+	if (kmerWidth < 11)
+		benchMerizer<std::array<unsigned int, 1>>(config, "uint32x1", kmerWidth, readLength);
+	if (kmerWidth < 22) {
+		benchMerizer<std::array<unsigned int, 2>>(config, "uint32x2", kmerWidth, readLength);
+		benchMerizer<std::bitset<64>>(config, "bitset64", kmerWidth, readLength);
+	}
+	if (kmerWidth < 43) {
+		benchMerizer<std::array<size_t, 2>>(config, "uint64x2", kmerWidth, readLength);
+		benchMerizer<std::bitset<128>>(config, "bitset128", kmerWidth, readLength);
+	}
+	benchMerizer<std::vector<char>>(config, "vector", kmerWidth, readLength);
+
+}
+
+struct BenchCounterAction {
+	BenchConfig & config;
+	string counterName;
+	string precision;
+	size_t kmerWidth;
+	size_t readLength;
+	template <class CounterType> KmerError run() {
+		benchCounter<CounterType>(config, counterName, precision, kmerWidth, readLength);
+		return KmerError();
+	};
+};
+
+//Each counter with the key type kmerCounter uses for kmerWidth
+template <typename Precision, typename InlinePrecision> void benchCounters(BenchConfig & config, string precision, size_t kmerWidth, size_t readLength) {
+
+	const char * counterNames[] = { "sort", "map", "unordered" };
+
+	for (char counterType = 0; counterType < 3; counterType++) {
+		BenchCounterAction action = { config, counterNames[(int)counterType], precision, kmerWidth, readLength };
+		KmerError err = withCounterType<Precision, InlinePrecision>(counterType, kmerWidth, action);
+		if (err.isError()) throw err;
+	}
+
+}
+
+template <typename C> void benchKeyCache(BenchConfig & config, string precision, size_t kmerWidth) {
+
+	typedef std::array<size_t, 2> T;
+	typedef KeyCache<T, C> Cache;
+
+	Merizer<T> merizer(kmerWidth);
+
+	//A pool of distinct keys, re-inserted round robin so the database sees both new keys and updates
+	auto reads = makeReads(256, 150);
+	vector<T> keys;
+	for (auto & read : reads) {
+		vector<char> encoded;
+		KmerCounter<>::encodeSequence(read, encoded);
+		auto tokens = merizer.getMerTokens(encoded);
+		keys.insert(keys.end(), tokens.begin(), tokens.end());
+	}
+
+	vector<pair<string, string>> params = { make_pair("k", to_string(kmerWidth)), make_pair("precision", precision) };
+
+	Cache cache("kmerBenchCache", true, 100, Cache::defaultMapSize(), false, kmerWidth);
+
+	for (auto & key : keys) {
+		typename Cache::EntryType entry(key, 1);
+		auto err = cache.incrementKey(entry);
+		if (err.isError()) throw err;
+	}
+
+	size_t next = 0;
+	runBenchmark(config, "BaseKeyCache::incrementKey", params, 1, [&]() {
+		typename Cache::EntryType entry(keys[next++ % keys.size()], 1);
+		auto err = cache.incrementKey(entry);
+		if (err.isError()) throw err;
+	});
+
+	//Asking for more than the top cache holds forces a full scan of the database
+	for (size_t top : { 10, 1000 }) {
+
+		auto topParams = params;
+		topParams.push_back(make_pair("top", to_string(top)));
+
+		runBenchmark(config, "BaseKeyCache::getTopKeys", topParams, 1, [&]() {
+			vector<typename Cache::EntryType> entries;
+			auto err = cache.getTopKeys(entries, top);
+			if (err.isError()) throw err;
+		});
+
+	}
+
+}
+
+static void writeJson(ostream & out, BenchConfig & config) {
+
+	out << "{" << endl;
+	out << "  \"context\": {\"compiler\": " << KmerStats::jsonString(__VERSION__) << ", \"minTime\": " << config.minTime << "}," << endl;
+	out << "  \"benchmarks\": [" << endl;
+
+	for (size_t i = 0; i < results.size(); i++) {
+
+		auto & r = results[i];
+		double rate = r.iterations * r.itemsPerIteration / r.seconds;
+
+		out << "    {\"name\": " << KmerStats::jsonString(r.name);
+		for (auto & p : r.params)
+			out << ", " << KmerStats::jsonString(p.first) << ": " << KmerStats::jsonString(p.second);
+		out << ", \"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds
+			<< ", \"nsPerIteration\": " << r.seconds / r.iterations * 1e9
+			<< ", \"itemsPerSecond\": " << rate << "}" << (i + 1 == results.size() ? "" : ",") << endl;
+
+	}
+
+	out << "  ]" << endl;
+	out << "}" << endl;
+
+}
+
+int main(int argc, char * argv[]) {
+
+	vector<string> args;
+	KmerError err = getAllArguments(argc, argv, args);
+	if (err.isError()) return displayError(err, cerr);
+
+	map<string, string> options;
+	err = getOptions(args, options);
+	if (err.isError()) return displayError(err, cerr);
+
+	BenchConfig config;
+	config.minTime = 0.5;
+	string outputPath;
+
+	try {
+		for (auto & i : options) {
+			if (i.first == "--out")
+				outputPath = i.second;
+			else if (i.first == "--min-time")
+				config.minTime = stod(i.second);
+			else if (i.first == "--filter")
+				config.filter = i.second;
+			else
+				return displayError(KmerError(1, "Unknown option " + i.first), cerr);
+		}
+
+		for (size_t readLength : { 100, 250 }) {
+
+			auto reads = makeReads(64, readLength);
+			size_t next = 0;
+
+			runBenchmark(config, "KmerCounter::encodeSequence", { make_pair("readLength", to_string(readLength)) }, readLength, [&]() {
+				vector<char> encoded;
+				KmerCounter<>::encodeSequence(reads[next++ % reads.size()], encoded);
+			});
+
+			for (size_t k : { 2, 5, 9, 15, 21, 31, 50 })
+				benchMerizers(config, k, readLength);
+
+		}
+
+		for (size_t k : { 9, 21, 31, 50 }) {
+			benchCounters<unsigned char, unsigned char>(config, "1", k, 150);
+			benchCounters<size_t, size_t>(config, "8", k, 150);
+			benchCounters<size_t, unsigned char>(config, "adaptive", k, 150);
+		}
+
+		for (size_t k : { 21, 31 }) {
+			benchKeyCache<unsigned int>(config, "4", k);
+			benchKeyCache<size_t>(config, "8", k);
+		}
+
+	}
+	catch (KmerError & e) {
+		return displayError(e, cerr);
+	}
+	catch (std::exception & e) {
+		return displayError(KmerError(e), cerr);
+	}
+
+	if (outputPath.size()) {
+		ofstream out(outputPath.c_str());
+		if (out.fail())
+			return displayError(KmerError(1, "Error opening " + outputPath), cerr);
+		writeJson(out, config);
+	}
+	else
+		writeJson(cout, config);
+
+	return 0;
+
+}
@@ -3,13 +3,74 @@
 #include "kmerError.h"
 #include "merizer.h"
 #include "keyCache.h"
+#include "backgroundFlusher.h"
+#include "arena.h"
+#include "kmerStats.h"
+#include "footprint.h"
+#include "histogram.h"
+#include "compactCountTable.h"
 #include <memory>
 #include <map>
 #include <unordered_map>
 #include <functional>
+#include <future>
+#include <deque>
 #include <algorithm>
 #include <locale>
 #include <limits> 
+#include <type_traits>
+#include <unistd.h>
+
+//Bytes the allocator actually hands out for a request of n bytes (glibc: 8 byte header, 16 byte granularity, 32 byte minimum).
+//Used to turn container sizes into a realistic memory footprint.
+inline size_t allocatedBytes(size_t n) {
+	return std::max<size_t>(32, (n + sizeof(size_t) + 15) & ~(size_t)15);
+}
+
+//Heap memory owned by a key on top of sizeof(T). Only the vector keys used for wide kmers own any.
+template <class T> struct KeyFootprint {
+	static size_t heapBytes(size_t) { return 0; };
+};
+
+template <> struct KeyFootprint<std::vector<char>> {
+	static size_t heapBytes(size_t kmerWidth) { return allocatedBytes(kmerWidth); };
+};
+
+//Run time options shared by all counters
+struct CounterSettings {
+
+	CounterSettings() :memoryBudget(0), memoryLimit(0), diskLimit(0), appendDatabase(false), checkpoints(false), segmentKmers(65536), merizeThreads(1) {};
+
+	//Total bytes the counter may use for its tables plus the database's memory map.
+	//0 keeps the fixed per-counter entry thresholds.
+	size_t memoryBudget;
+
+	//Hard limits on the tracked memory and the database file (see Footprint). 0 means unlimited.
+	//Without a memory budget, the budget is derived from the memory limit.
+	size_t memoryLimit;
+	size_t diskLimit;
+
+	//Where to keep the database once the counter is done, so it can be queried later.
+	//Empty uses a scratch database that's removed with the counter.
+	std::string databasePath;
+
+	//File for the scratch database (see ScratchSpace). Empty uses kmerCache.<pid> in the working directory.
+	std::string scratchPath;
+
+	//Add to the counts already in databasePath instead of starting over
+	bool appendDatabase;
+
+	//The caller takes checkpoints (see MerizierKmerCounter::checkpoint), the database only keeps what they committed.
+	//A scratch database is then kept until removeDatabaseWhenDone.
+	bool checkpoints;
+
+	//Reads with more kmers than segmentKmers are merized and counted a segment at a time (see
+	//MerizierKmerCounter::forEachSegment). With merizeThreads > 1 the next segments are merized on
+	//other threads while one is counted.
+	size_t segmentKmers;
+	size_t merizeThreads;
+
+};
 
 //KmerCounter implements hashing/sorting algorithms independent from how kmers are expressed.
 //With one exception - it accepts the original GTACN characters as a string and then converts it into
@@ -40,34 +101,43 @@ public:
 
 	KmerCounter(size_t _kmerWidth) :kmerWidth(_kmerWidth) {};
 	
-	virtual KmerError addSequence(std::string sequence) = 0;
-	virtual KmerError getTopMers(MerList & mers, size_t num, C threshold) = 0;
+	//weight is the number of times the read was seen, every kmer of it is counted that many times.
+	//allowMasked accepts the maskedBase a masking FastqReader leaves in its sequences.
+	virtual KmerError addSequence(std::string sequence, size_t weight = 1, bool allowMasked = false) {
 
-	KmerError decodeSequence(std::vector<char> encoded, std::string & decoded) {
+		std::vector<char> encoded;
+		KmerError err = encodeSequence(sequence, encoded, allowMasked);
+		if (err.isError()) return err;
 
-		decoded.resize(encoded.size());
-		for (auto i = 0; i < encoded.size(); i++) {
+		return addEncodedSequence(encoded, weight);
 
-			switch (encoded[i]) {
-			case 0:
-				decoded[i] = 'G';
-				break;
-			case 1:
-				decoded[i] = 'T';
-				break;
-			case 2:
-				decoded[i] = 'C';
-				break;
-			case 3:
-				decoded[i] = 'A';
-				break;
-			case 4:
-				decoded[i] = 'N';
-				break;
-			default:
+	};
+
+	//Counts the kmers of a read already run through encodeSequence, so one encoding can feed counters of several k
+	virtual KmerError addEncodedSequence(const std::vector<char> & encoded, size_t weight = 1) = 0;
+
+	//histogram, when given, is filled with the abundance of every kmer counted, and table receives
+	//every kmer at or above the threshold
+	virtual KmerError getTopMers(MerList & mers, size_t num, C threshold, AbundanceHistogram * histogram = nullptr, CountTableWriter * table = nullptr) = 0;
+
+	static KmerError decodeSequence(const std::vector<char> & encoded, std::string & decoded) {
+
+		decoded.clear();
+		return appendDecodedSequence(encoded, decoded);
+
+	}
+
+	//Decodes onto the end of out, so results can be written straight into an output buffer
+	static KmerError appendDecodedSequence(const std::vector<char> & encoded, std::string & out) {
+
+		static const char bases[] = { 'G', 'T', 'C', 'A', 'N' };
+
+		for (auto i : encoded) {
+
+			if (i < 0 || i > 4)
 				return KmerError(1, "Got invalid encoded value");
-			}
 
+			out += bases[(int)i];
 
 		}
 
@@ -75,7 +145,11 @@ public:
 
 	}
 
-	KmerError encodeSequence(std::string decoded, std::vector<char> & encoded) {
+	//maskedBase is only valid with allowMasked, for sequences that went through a masking FastqReader.
+	//Anything else, a query for one, gets it reported as an invalid character.
+	static KmerError encodeSequence(std::string decoded, std::vector<char> & encoded, bool allowMasked = false) {
+
+		KMER_STATS_SCOPE(Encode);
 
 		//Force string to be upper case. Supposedly (from what I read) lower case characters are converted to upper case in this kind of application.
 
@@ -101,6 +175,11 @@ public:
 			case 'N':
 				encoded[i] = 4;
 				break;
+			case maskedBase:
+				if (!allowMasked)
+					return KmerError(1, "Got invalid sequence character");
+				encoded[i] = maskedBaseCode;
+				break;
 			default:
 				return KmerError(1, "Got invalid sequence character");
 			}
@@ -124,58 +203,344 @@ template <class T, typename C = size_t> class MerizierKmerCounter : public KmerC
 
 public:
 
-	MerizierKmerCounter(size_t kmerWidth, size_t _cacheOnEntries) : KmerCounter<C>(kmerWidth), merizer(kmerWidth), cache("kmerCache",true), cacheOnEntries(_cacheOnEntries) {};
-	virtual KmerError addSequence(std::string sequence) = 0;
-	virtual KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold) = 0;
+	//tablesInFlight is the number of tables the counter can hold at once (the active one, the one being flushed and any flush scratch space).
+	//The memory budget left after the database map is split evenly between them.
+	//compactCounts stores counts below 255 as a single byte in the database.
+	MerizierKmerCounter(size_t kmerWidth, size_t _cacheOnEntries, CounterSettings settings, size_t tablesInFlight, bool compactCounts = false) : KmerCounter<C>(kmerWidth), merizer(kmerWidth),
+		cache(settings.databasePath.empty() ? (settings.scratchPath.empty() ? getScratchName() : settings.scratchPath) : settings.databasePath, settings.databasePath.empty() && !settings.checkpoints, 100, getCacheMapSize(settings), compactCounts, kmerWidth,
+			settings.appendDatabase ? KeyCache<T, C>::Append : KeyCache<T, C>::Create), cacheOnEntries(_cacheOnEntries), flushOnBytes(0), peakTableBytes(0), tableNodeBytes(0),
+		checkpointCount(0),
+		segmentKmers(std::max<size_t>(settings.segmentKmers, 1)), merizeThreads(std::max<size_t>(settings.merizeThreads, 1)) {
+
+		if (settings.memoryLimit && settings.memoryBudget > settings.memoryLimit)
+			throw KmerError(1, "Memory budget is larger than the memory limit");
+
+		if (settings.checkpoints) {
+			KmerError err = cache.beginCheckpoints();
+			if (err.isError()) throw err;
+		}
+
+		footprint.setLimits(settings.memoryLimit, settings.diskLimit);
+		cache.setDiskLimit(settings.diskLimit);
+
+		size_t budget = getBudget(settings);
+
+		if (budget) {
+
+			size_t mapSize = getCacheMapSize(settings);
+			if (budget <= mapSize)
+				throw KmerError(1, "Memory budget too small");
+
+			flushOnBytes = (budget - mapSize) / tablesInFlight;
+
+			//Tables are measured by the arena blocks they hold, so blocks have to be small next to the threshold
+			for (auto & arena : tableArenas)
+				arena.setBlockSize(std::max<size_t>(std::min<size_t>(flushOnBytes / 16, Arena::defaultBlockSize), 64 * 1024));
+		}
+
+	};
+	virtual KmerError addEncodedSequence(const std::vector<char> & encoded, size_t weight = 1) = 0;
+	virtual KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold, AbundanceHistogram * histogram = nullptr, CountTableWriter * table = nullptr) = 0;
 	
+	//Time the background flusher spent writing to the database, and how much of it the counting thread had to wait for.
+	double getFlushTime() { return flusher.getFlushTime(); };
+	double getFlushStallTime() { return flusher.getStallTime(); };
+	size_t getFlushCount() { return flusher.getFlushCount(); };
+
+	//Largest footprint reached by a single table, in bytes
+	size_t getPeakTableBytes() { return peakTableBytes; };
+
+	//Table nodes served by the arenas, and how many of those actually went to the system allocator
+	size_t getArenaAllocations() { return tableArenas[0].getAllocationCount() + tableArenas[1].getAllocationCount(); };
+	size_t getArenaBlocks() { return tableArenas[0].getBlockCount() + tableArenas[1].getBlockCount(); };
+
+	//Estimated seconds of malloc and free the arenas saved: a timed allocation of one table node for every node served
+	double getArenaSavedTime() {
+		if (!tableNodeBytes) return 0;
+		return Arena::getSystemAllocationTime(tableNodeBytes) * (getArenaAllocations() - getArenaBlocks());
+	};
+
+	size_t getDatabaseSize() { return cache.getDatabaseSize(); };
+
+	//Kmers the last flush left out of the database for being below the minimum count, and their estimated size there
+	size_t getMinCountSkipped() { return cache.getSkippedBelowMin(); };
+	size_t getMinCountSkippedBytes() { return cache.getSkippedBelowMinBytes(); };
+
+	//Per subsystem memory and disk usage of this counter. The caller adds its reader buffers.
+	Footprint & getFootprint() { return footprint; };
+
+	//Nothing flushed and no earlier run's counts to add to, so the last flush holds every kmer's full count
+	bool lastFlushSeesAll() { return getFlushCount() == 0 && checkpointCount == 0 && !cache.hasPriorRecords(); };
+
+	//Flushes everything counted so far and commits the database as the given generation. After a crash
+	//it reopens (appending) as of the last checkpoint, see getCheckpoint.
+	KmerError checkpoint(uint32_t generation) {
+
+		KmerError err = flusher.wait();
+		if (err.isError()) return err;
+
+		beginFlush();
+		err = flushActive();
+		err |= endFlush();
+		if (err.isError()) return err;
+
+		checkpointCount++;
+		return cache.checkpoint(generation);
+
+	};
+
+	//Generation of the checkpoint the database was last committed at, 0 for none
+	uint32_t getCheckpoint() { return cache.getCheckpoint(); };
+
+	//A checkpointed scratch database outlives failed runs so they can be resumed, finished ones drop it
+	void removeDatabaseWhenDone() { cache.removeOnClose(); };
+
+	//Whether counts were added to a database kept by an earlier run
+	bool isAppending() { return cache.hasPriorRecords(); };
+
 	virtual ~MerizierKmerCounter() {}; //need virtual destructor for proper cleanup. don't really need to do anything for this base class destructor
 
 protected:
 
-	virtual KmerError flushToCache() = 0;
+	//An explicit budget, or nine tenths of the memory limit. The rest is headroom for the reader,
+	//the top cache and a table overshooting its flush threshold by one read.
+	static size_t getBudget(CounterSettings & settings) {
+
+		if (settings.memoryBudget)
+			return settings.memoryBudget;
+
+		return settings.memoryLimit - settings.memoryLimit / 10;
+
+	};
+
+	//Scratch databases are named after the process, so several runs (or worker processes) can share a directory
+	static std::string getScratchName() {
+		return "kmerCache." + std::to_string(getpid());
+	};
+
+	//Writes the active table to the database on the counting thread
+	virtual KmerError flushActive() = 0;
+
+	//Hands count the tokens of an encoded read. A long read is cut
+	//into segments of segmentKmers kmers, each with the kmerWidth - 1 following bases, so every kmer is in
+	//exactly one segment and no more than a segment's tokens are held at once. Up to merizeThreads segments
+	//are merized ahead on their own threads; count sees them in read order on the calling thread.
+	template <class Count> KmerError forEachSegment(const std::vector<char> & encoded, Count count) {
+
+		size_t kmers = encoded.size() >= this->kmerWidth ? encoded.size() - this->kmerWidth + 1 : 0;
+
+		if (kmers <= segmentKmers) {
+			std::vector<T> tokens;
+			{
+				KMER_STATS_SCOPE(Merize);
+				tokens = merizer.getMerTokens(encoded);
+			}
+			return count(tokens);
+		}
+
+		size_t segments = (kmers - 1) / segmentKmers + 1;
+
+		auto merizeSegment = [this, &encoded](size_t segment) {
+			auto begin = encoded.begin() + segment * segmentKmers;
+			auto end = encoded.begin() + std::min(encoded.size(), segment * segmentKmers + segmentKmers + this->kmerWidth - 1);
+			return merizer.getMerTokens(std::vector<char>(begin, end));
+		};
+
+		//Inline without helper threads, the segment is merized when it's asked for
+		auto policy = merizeThreads > 1 ? std::launch::async : std::launch::deferred;
+		std::deque<std::future<std::vector<T>>> ahead;
+		size_t next = 0;
+
+		KmerError err;
+		for (size_t segment = 0; segment < segments && !err.isError(); segment++) {
+
+			while (next < segments && ahead.size() < merizeThreads)
+				ahead.push_back(std::async(policy, merizeSegment, next++));
+
+			std::vector<T> tokens;
+			{
+				KMER_STATS_SCOPE(Merize);
+				tokens = ahead.front().get();
+				ahead.pop_front();
+			}
+			err = count(tokens);
+
+		}
+
+		//Segments still being merized after an error are waited for by their futures
+		return err;
+
+	};
+
+	//Give the database a quarter of the budget for its memory map, but never more than it gets by default
+	static size_t getCacheMapSize(CounterSettings & settings) {
+
+		size_t mapSize = KeyCache<T, C>::defaultMapSize();
+
+		if (getBudget(settings))
+			mapSize = std::min(mapSize, getBudget(settings) / 4);
+
+		return mapSize;
+
+	};
+
+	//Records the active table's entry count and footprint, and decides whether it has to be flushed.
+	//Fails if the table pushes the tracked memory over the limit.
+	KmerError checkTable(size_t entries, size_t bytes, bool & full) {
+
+		peakTableBytes = std::max(peakTableBytes, bytes);
+
+		if (flushOnBytes)
+			full = bytes > flushOnBytes;
+		else
+			full = entries > cacheOnEntries;
+
+		return footprint.update(Footprint::Tables, bytes);
+
+	};
+
+	//Footprint bookkeeping for a flush: the active table's bytes move to the flush slot before it is
+	//handed over, and once it has been written out the slot is emptied and the database figures refreshed.
+	void beginFlush() {
+		footprint.update(Footprint::FlushTables, footprint.getCurrent(Footprint::Tables));
+		footprint.update(Footprint::Tables, 0);
+	};
+
+	KmerError endFlush() {
+
+		size_t databaseBytes = cache.getDatabaseSize();
+
+		KmerError err = footprint.update(Footprint::FlushTables, 0);
+		err |= footprint.update(Footprint::TopCache, cache.getTopCacheSize() * (allocatedBytes(2 * sizeof(void *) + sizeof(typename KeyCache<T, C>::EntryType)) + KeyFootprint<T>::heapBytes(this->kmerWidth)));
+		err |= footprint.update(Footprint::DatabaseMap, std::min(databaseBytes, cache.getMapSize()));
+		err |= footprint.update(Footprint::DatabaseFile, databaseBytes + cache.getTransactionLogSize());
+
+		return err;
+
+	};
+
+	//Adaptive counters. Tables hold narrow inline counters of type I; once one saturates the rest of
+	//the count goes to an overflow table keyed the same way, holding full precision C counts.
+	//With I == C this is plain saturating addition and the overflow table is never touched.
+	template <typename I, class Overflow> void incrementCount(I & val, const T & key, Overflow & overflow, size_t weight = 1) {
+
+		size_t room = std::numeric_limits<I>::max() - val;
+		if (weight <= room) {
+			val += weight;
+			return;
+		}
+
+		val = std::numeric_limits<I>::max();
+		weight -= room;
+
+		if (sizeof(I) < sizeof(C)) {
+			auto & extra = overflow[key];
+			size_t extraRoom = (std::numeric_limits<C>::max() - std::numeric_limits<I>::max()) - extra;
+			extra += std::min(weight, extraRoom);
+		}
+
+	};
+
+	template <typename I, class Overflow> C getCount(I val, const T & key, Overflow & overflow) {
+
+		if (sizeof(I) == sizeof(C) || val != std::numeric_limits<I>::max())
+			return val;
+
+		auto extra = overflow.find(key);
+		if (extra == overflow.end())
+			return val;
+
+		return (C)val + extra->second;
+
+	};
+
+	//Release a node based table's arena in one go instead of freeing its nodes one by one
+	template <class Table> void releaseTable(Table & table) {
+
+		Arena * arena = table.get_allocator().getArena();
+		Table(table.get_allocator()).swap(table); //old nodes are destroyed with the temporary, deallocation is a no-op
+		arena->reset();
+
+	};
+
+	//A compact table has no arena, it keeps its slots for the next fill instead
+	template <class K, typename V, class H> void releaseTable(CompactCountTable<K, V, H> & table) {
+		table.clear();
+	};
 
 	size_t cacheOnEntries;
+	size_t flushOnBytes;
+	size_t peakTableBytes;
+	Footprint footprint;
+	Arena tableArenas[2]; //backing store for the active and flushing tables of the node based counters
+	size_t tableNodeBytes; //size of one of their nodes, 0 for counters without them
 	Merizer<T> merizer;
 	KeyCache<T, C> cache;
+	size_t checkpointCount;
+	size_t segmentKmers;
+	size_t merizeThreads;
+	BackgroundFlusher flusher; //declared after cache so it's joined before the cache is closed
 };
 
 
-template <class T, typename C = size_t, class L = std::greater<T>> class HashMerizedKmerCounter : public MerizierKmerCounter<T, C> {
+//I is the width of the counters held in the table. A narrower I than C gives adaptive counters (see MerizierKmerCounter::incrementCount).
+template <class T, typename C = size_t, class L = std::greater<T>, typename I = C> class HashMerizedKmerCounter : public MerizierKmerCounter<T, C> {
 	
 
 public:
 
-	HashMerizedKmerCounter(size_t kmerWidth, size_t cacheOnEntries = 10000000) : MerizierKmerCounter<T, C>(kmerWidth, cacheOnEntries) {};
+	HashMerizedKmerCounter(size_t kmerWidth, CounterSettings settings = CounterSettings(), size_t cacheOnEntries = 10000000) : MerizierKmerCounter<T, C>(kmerWidth, cacheOnEntries, settings, 2, sizeof(I) < sizeof(C)),
+		hashTable(Allocator(&this->tableArenas[0])), flushTable(Allocator(&this->tableArenas[1])) {
 
-	KmerError addSequence(std::string sequence) {
+		keyHeapBytes = KeyFootprint<T>::heapBytes(kmerWidth);
+		overflowEntryBytes = allocatedBytes(4 * sizeof(void *) + sizeof(typename Overflow::value_type)) + keyHeapBytes;
+		this->tableNodeBytes = 4 * sizeof(void *) + sizeof(typename Table::value_type);
 
-		std::vector<char> encodedSequence;
-		auto err = this->encodeSequence(sequence, encodedSequence);
-		if (err.isError()) return err;
-		auto tokens = this->merizer.getMerTokens(encodedSequence);
+	};
 
-		for (auto & i : tokens) {
-			auto & val = hashTable[i];
-			if(val != std::numeric_limits<C>::max())
-				val++;
-		};
+	KmerError addEncodedSequence(const std::vector<char> & encodedSequence, size_t weight = 1) {
 
-		if(hashTable.size() > this->cacheOnEntries)
-			return flushToCache();
+		return this->forEachSegment(encodedSequence, [this, weight](std::vector<T> & tokens) {
 
-		return KmerError();
+			KMER_STATS_ADD(Kmers, tokens.size());
+
+			{
+				KMER_STATS_SCOPE(Count);
+				for (auto & i : tokens)
+					this->incrementCount(hashTable[i], i, overflow, weight);
+			}
+
+			bool full = false;
+			KmerError err = this->checkTable(hashTable.size(), hashTable.get_allocator().getArena()->getBytesReserved() + hashTable.size() * keyHeapBytes + overflow.size() * overflowEntryBytes, full);
+			if(err.isError()) return err;
+
+			if(full)
+				return swapAndFlush();
+
+			return KmerError();
+
+		});
 
 	};
 
-	KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold = 1) {
+	KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold = 1, AbundanceHistogram * histogram = nullptr, CountTableWriter * table = nullptr) {
 
+        KmerError err = this->flusher.wait();
+        if(err.isError()) return err;
+
+        //With nothing in the database yet the last flush sees every kmer's full count, so it can fill the
+        //histogram and leave the top keys to the top cache. Otherwise, or when the scan runs anyway for
+        //the count table, the database scan fills it.
+        AbundanceHistogram * flushHistogram = this->lastFlushSeesAll() && table == nullptr ? histogram : nullptr;
 
-        KmerError err = flushToCache();
+        this->beginFlush();
+        err = flushToCache(hashTable, overflow, threshold, flushHistogram);
+        err |= this->endFlush();
         if(err.isError()) return err;
 
         std::vector<typename KeyCache<T,C>::EntryType> topEntries;
 
-        err = this->cache.getTopKeys(topEntries, num, threshold);
+        err = this->cache.getTopKeys(topEntries, num, threshold, flushHistogram ? nullptr : histogram, table);
 		if(err.isError()) return err;
 		mers.clear();
         mers.reserve(topEntries.size());
@@ -189,22 +554,53 @@ public:
 
 	};
 
+	~HashMerizedKmerCounter() { this->flusher.wait(); }; //flusher may still be working on flushTable
+
 protected:
 
-	KmerError flushToCache(){
+	typedef ArenaAllocator<std::pair<const T, I>> Allocator;
+	typedef std::map<T, I, L, Allocator> Table;
+	typedef std::map<T, C, L> Overflow;
+
+	KmerError flushActive(){
+		return flushToCache(hashTable, overflow);
+	};
+
+	//Hand the full table to the flusher thread and keep counting into the (empty) spare one
+	KmerError swapAndFlush(){
+
+		KmerError err = this->flusher.wait();
+		if(err.isError()) return err;
+
+		this->beginFlush();
+		std::swap(hashTable, flushTable);
+		std::swap(overflow, flushOverflow);
+
+		return this->flusher.submit([this]() { KmerError err = flushToCache(flushTable, flushOverflow); err |= this->endFlush(); return err; });
+
+	};
+
+	//minNewCount is only passed on the last flush, see BaseKeyCache::incrementKey, and so is histogram
+	KmerError flushToCache(Table & table, Overflow & tableOverflow, C minNewCount = 0, AbundanceHistogram * histogram = nullptr){
+
+		KMER_STATS_SCOPE(Flush);
+		KMER_STATS_ADD(Flushes, 1);
+		KMER_STATS_ADD(FlushedEntries, table.size());
 
 		KmerError err;
        typename KeyCache<T,C>::EntryType entry;
 
-		for(auto & i : hashTable){
+		for(auto & i : table){
 			entry.first = i.first;
-			entry.second = i.second;
+			entry.second = this->getCount(i.second, i.first, tableOverflow);
+			if(histogram) histogram->add(entry.second);
 
-			err = this->cache.incrementKey(entry);
+			err = this->cache.incrementKey(entry, minNewCount);
 			if(err.isError()) return err;
 		};
 
-		hashTable.clear();
+		this->releaseTable(table);
+		tableOverflow.clear();
 
 
 		return KmerError();
@@ -212,7 +608,12 @@ protected:
 
 private:
 
-	std::map<T, C, L> hashTable;
+	Table hashTable;
+	Table flushTable;
+	Overflow overflow;
+	Overflow flushOverflow;
+	size_t keyHeapBytes;
+	size_t overflowEntryBytes;
 
 };
 
@@ -246,37 +647,69 @@ template <typename T> struct VectorHasher
 
 
 
-template <class T, typename C = size_t, class L = std::greater<T>> class SortMerizedKmerCounter : public MerizierKmerCounter<T, C> {
+//Runs are counted at full precision C while consolidating, so I only selects compact count storage in the database.
+template <class T, typename C = size_t, class L = std::greater<T>, typename I = C> class SortMerizedKmerCounter : public MerizierKmerCounter<T, C> {
 
 
 	public:
 
-		SortMerizedKmerCounter(size_t kmerWidth, size_t cacheOn = 100000) : MerizierKmerCounter<T, C>(kmerWidth, cacheOn) {
+		//Three token sets can be alive at once: the one being collected, the one being flushed and the flush's sort buffer
+		SortMerizedKmerCounter(size_t kmerWidth, CounterSettings settings = CounterSettings(), size_t cacheOn = 100000) : MerizierKmerCounter<T, C>(kmerWidth, cacheOn, settings, 3, sizeof(I) < sizeof(C)), weightedReads(0), tokenBytes(0) {
 			tokens.reserve(this->cacheOnEntries);
 		};
 
-		KmerError addSequence(std::string sequence) {
+		//A read seen several times keeps its tokens with their weight, next to the plain token lists
+		KmerError addEncodedSequence(const std::vector<char> & encodedSequence, size_t weight = 1) {
 
-			std::vector<char> encodedSequence;
-			auto err = this->encodeSequence(sequence, encodedSequence);
-			if (err.isError()) return err;
-			tokens.push_back(std::make_shared<std::vector<T>>(this->merizer.getMerTokens(encodedSequence)));
+			if (weight > 1)
+				return addWeightedSequence(encodedSequence, weight);
 
-			if(tokens.size() > this->cacheOnEntries)
-				return flushToCache();
+			//each segment of a long read is a token list of its own
+			return this->forEachSegment(encodedSequence, [this](std::vector<T> & readTokens) {
 
-			return KmerError();
+				KMER_STATS_ADD(Kmers, readTokens.size());
+
+				//token storage, per key heap memory and the make_shared block holding the vector
+				tokenBytes += allocatedBytes(readTokens.size() * sizeof(T)) + readTokens.size() * KeyFootprint<T>::heapBytes(this->kmerWidth)
+					+ allocatedBytes(sizeof(std::vector<T>) + 2 * sizeof(long)) + sizeof(typename TokenList::value_type);
+				tokens.push_back(std::make_shared<std::vector<T>>(std::move(readTokens)));
+
+				bool full = false;
+				KmerError err = this->checkTable(tokens.size() + weightedReads, tokenBytes, full);
+				if(err.isError()) return err;
+
+				if(full)
+					return swapAndFlush();
+
+				return KmerError();
+
+			});
 
 		};
 
-        KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold = 1) {
+        KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold = 1, AbundanceHistogram * histogram = nullptr, CountTableWriter * table = nullptr) {
+
+            KmerError err = this->flusher.wait();
+            if(err.isError()) return err;
 
-            KmerError err = flushToCache();
+            //With nothing in the database yet the last flush sees every kmer's full count, so it can fill the
+            //histogram and leave the top keys to the top cache. Otherwise, or when the scan runs anyway for
+            //the count table, the database scan fills it.
+            AbundanceHistogram * flushHistogram = this->lastFlushSeesAll() && table == nullptr ? histogram : nullptr;
+
+            //Nothing left over if the last read or a checkpoint triggered a flush, and nothing at all for
+            //input without a kmer (empty, or every read masked or too short)
+            if(hasTokens()){
+                this->beginFlush();
+                err = flushToCache(tokens, weightedTokens, threshold, flushHistogram);
+                err |= this->endFlush();
+            }
             if(err.isError()) return err;
 
             std::vector<typename KeyCache<T,C>::EntryType> topEntries;
 
-            err = this->cache.getTopKeys(topEntries, num, threshold);
+            err = this->cache.getTopKeys(topEntries, num, threshold, flushHistogram ? nullptr : histogram, table);
+            if(err.isError()) return err;
 
             mers.reserve(topEntries.size());
 
@@ -316,66 +749,148 @@ template <class T, typename C = size_t, class L = std::greater<T>> class SortMer
 
 		};
 #endif
+
+		~SortMerizedKmerCounter() { this->flusher.wait(); }; //flusher may still be working on flushTokens
+
 	protected:
 
-		KmerError flushToCache(){
+		typedef std::vector < std::shared_ptr<std::vector<T>>> TokenList;
+		typedef std::vector<std::pair<T, size_t>> WeightedTokenList;
+
+		KmerError addWeightedSequence(const std::vector<char> & encodedSequence, size_t weight) {
+
+			return this->forEachSegment(encodedSequence, [this, weight](std::vector<T> & readTokens) {
+
+				KMER_STATS_ADD(Kmers, readTokens.size());
+
+				size_t before = weightedTokens.capacity();
+				for (auto & i : readTokens)
+					weightedTokens.emplace_back(std::move(i), weight);
+				weightedReads++;
+
+				tokenBytes += allocatedBytes((weightedTokens.capacity() - before) * sizeof(typename WeightedTokenList::value_type))
+					+ readTokens.size() * KeyFootprint<T>::heapBytes(this->kmerWidth);
+
+				bool full = false;
+				KmerError err = this->checkTable(tokens.size() + weightedReads, tokenBytes, full);
+				if(err.isError()) return err;
+
+				if(full)
+					return swapAndFlush();
+
+				return KmerError();
+
+			});
+
+		};
+
+		//Reads too short for a kmer leave empty token lists, which flushToCache would take for an error
+		bool hasTokens(){
+
+			bool anyTokens = !weightedTokens.empty();
+			for (auto & i : tokens)
+				anyTokens |= !i->empty();
+
+			return anyTokens;
+
+		};
+
+		KmerError flushActive(){
+
+			KmerError err;
+			if (hasTokens())
+				err = flushToCache(tokens, weightedTokens);
+
+			tokens.clear();
+			WeightedTokenList().swap(weightedTokens);
+			weightedReads = 0;
+			tokenBytes = 0;
+			return err;
+
+		};
+
+		//Hand the collected tokens to the flusher thread and keep collecting into the (empty) spare list
+		KmerError swapAndFlush(){
+
+			KmerError err = this->flusher.wait();
+			if(err.isError()) return err;
+
+			this->beginFlush();
+			std::swap(tokens, flushTokens);
+			std::swap(weightedTokens, flushWeightedTokens);
+			tokens.reserve(this->cacheOnEntries);
+			weightedReads = 0;
+			tokenBytes = 0;
+
+			return this->flusher.submit([this]() { KmerError err = flushToCache(flushTokens, flushWeightedTokens); err |= this->endFlush(); return err; });
+
+		};
+
+		//minNewCount is only passed on the last flush, see BaseKeyCache::incrementKey, and so is histogram.
+		//The plain tokens and the weighted ones are sorted separately and merged while counting.
+		KmerError flushToCache(TokenList & tokenList, WeightedTokenList & weightedList, C minNewCount = 0, AbundanceHistogram * histogram = nullptr){
+
+			KMER_STATS_SCOPE(Flush);
+			KMER_STATS_ADD(Flushes, 1);
 
 			typename KeyCache<T,C>::EntryType entry;
 
 			//copy all tokens into single vector
 			size_t totalTokens = 0;
-			for (auto i = 0; i < tokens.size(); i++) {
-				totalTokens += tokens[i]->size();
+			for (auto i = 0; i < tokenList.size(); i++) {
+				totalTokens += tokenList[i]->size();
 			}
 
-			if (totalTokens == 0)
+			if (totalTokens == 0 && weightedList.empty())
 				return KmerError(1, "No mers generated.");
 
 			std::vector<T> tempArray; tempArray.reserve(totalTokens);
+
+			//sort scratch is the third table in flight
+			KmerError err = this->footprint.update(Footprint::FlushTables, this->footprint.getCurrent(Footprint::FlushTables) + allocatedBytes(totalTokens * sizeof(T)));
+			if(err.isError()) return err;
 			size_t copyCount = 0;
-			for (auto i = 0; i < tokens.size(); i++) {
-				tempArray.insert(tempArray.begin() + copyCount, tokens[i]->begin(), tokens[i]->end());
-				copyCount += tokens[i]->size();
+			for (auto i = 0; i < tokenList.size(); i++) {
+				tempArray.insert(tempArray.begin() + copyCount, tokenList[i]->begin(), tokenList[i]->end());
+				copyCount += tokenList[i]->size();
 			}
 
 			//Sort tokens, consolidate
-			std::sort(tempArray.begin(), tempArray.end(), L());
+			L less;
+			std::sort(tempArray.begin(), tempArray.end(), less);
+			std::sort(weightedList.begin(), weightedList.end(), [&less](const typename WeightedTokenList::value_type & a, const typename WeightedTokenList::value_type & b) { return less(a.first, b.first); });
 
-			T thisToken = tempArray[0];
-			C count = 0;
+			size_t plain = 0;
+			size_t weighted = 0;
+			size_t uniqueTokens = 0;
 
-			KmerError err;
-
-			for (auto i = 0; i < tempArray.size(); i++) {
+			while (plain < tempArray.size() || weighted < weightedList.size()) {
 
-				if (tempArray[i] != thisToken) {
-					//create new entry if above threshold
-					entry.first = thisToken;
-					entry.second = count;
-					err = this->cache.incrementKey(entry);
-					if(err.isError()) return err;
-					thisToken = tempArray[i];
-					count = 0;
-				}
+				//next key in sort order, from whichever list has it first
+				bool fromPlain = weighted == weightedList.size() || (plain < tempArray.size() && !less(weightedList[weighted].first, tempArray[plain]));
+				T thisToken = fromPlain ? tempArray[plain] : weightedList[weighted].first;
+				size_t count = 0;
 
-				if (count != std::numeric_limits<C>::max())
+				for (; plain < tempArray.size() && tempArray[plain] == thisToken; plain++)
 					count++;
+				for (; weighted < weightedList.size() && weightedList[weighted].first == thisToken; weighted++)
+					count += weightedList[weighted].second;
 
-			}
-
-			if(count!=0){
-				//write out the remainder
+				//create new entry, saturating the count
 				entry.first = thisToken;
-				entry.second = count;
-
-				err = this->cache.incrementKey(entry);
+				entry.second = (C)std::min<size_t>(count, std::numeric_limits<C>::max());
+				if(histogram) histogram->add(entry.second);
+				err = this->cache.incrementKey(entry, minNewCount);
 				if(err.isError()) return err;
-
+				uniqueTokens++;
 
 			}
 
+			KMER_STATS_ADD(FlushedEntries, uniqueTokens);
 
-			tokens.clear();
+
+			tokenList.clear();
+			WeightedTokenList().swap(weightedList);
 
 			return KmerError();
 		};
@@ -385,45 +900,80 @@ template <class T, typename C = size_t, class L = std::greater<T>> class SortMer
 
 		size_t expectedEntries;
 		float resizeFactor;
-		std::vector < std::shared_ptr<std::vector<T>>> tokens;
+		TokenList tokens;
+		TokenList flushTokens;
+		WeightedTokenList weightedTokens;
+		WeightedTokenList flushWeightedTokens;
+		size_t weightedReads;
+		size_t tokenBytes;
 
 };
 
 
-template <class T, typename C = size_t, class L = std::hash<T>> class UnorderedHashMerizedKmerCounter : public MerizierKmerCounter<T, C> {
+//I is the width of the counters held in the table. A narrower I than C gives adaptive counters (see MerizierKmerCounter::incrementCount),
+//kept in a CompactCountTable so that the narrow counter is all an entry pays for it in memory.
+template <class T, typename C = size_t, class L = std::hash<T>, typename I = C> class UnorderedHashMerizedKmerCounter : public MerizierKmerCounter<T, C> {
 	//add static assert that counter precision supports
 	public:
 
-		UnorderedHashMerizedKmerCounter(size_t kmerWidth, size_t cacheOn = 100000000) : MerizierKmerCounter<T, C>(kmerWidth, cacheOn) {};
+		UnorderedHashMerizedKmerCounter(size_t kmerWidth, CounterSettings settings = CounterSettings(), size_t cacheOn = 100000000) : MerizierKmerCounter<T, C>(kmerWidth, cacheOn, settings, 2, sizeof(I) < sizeof(C)),
+			hashTable(newTable(&this->tableArenas[0], IsCompact())), flushTable(newTable(&this->tableArenas[1], IsCompact())) {
 
-		KmerError addSequence(std::string sequence) {
+			keyHeapBytes = KeyFootprint<T>::heapBytes(kmerWidth);
+			overflowEntryBytes = allocatedBytes(2 * sizeof(void *) + sizeof(typename Overflow::value_type)) + keyHeapBytes;
+			this->tableNodeBytes = IsCompact::value ? 0 : 2 * sizeof(void *) + sizeof(std::pair<const T, I>);
 
-			std::vector<char> encodedSequence;
-			auto err = this->encodeSequence(sequence, encodedSequence);
-			if (err.isError()) return err;
-			auto tokens = this->merizer.getMerTokens(encodedSequence);
+		};
 
-			for (auto & i : tokens) {
-				auto & val = hashTable[i];
-				if(val != std::numeric_limits<C>::max())
-					hashTable[i]++;
-			};
+		KmerError addEncodedSequence(const std::vector<char> & encodedSequence, size_t weight = 1) {
 
-			if(hashTable.size()>this->cacheOnEntries)
-				return flushToCache();
+			return this->forEachSegment(encodedSequence, [this, weight](std::vector<T> & tokens) {
 
-			return KmerError();
+				KMER_STATS_ADD(Kmers, tokens.size());
+
+				if (!hasRoomFor(hashTable, tokens.size())) {
+					KmerError err = swapAndFlush();
+					if(err.isError()) return err;
+				}
+
+				{
+					KMER_STATS_SCOPE(Count);
+					for (auto & i : tokens)
+						this->incrementCount(hashTable[i], i, overflow, weight);
+				}
+
+				bool full = false;
+				KmerError err = this->checkTable(hashTable.size(), getTableBytes(hashTable) + hashTable.size() * keyHeapBytes + overflow.size() * overflowEntryBytes, full);
+				if(err.isError()) return err;
+
+				if(full)
+					return swapAndFlush();
+
+				return KmerError();
+
+			});
 
 		};
 
-		KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold = 1) {
+		KmerError getTopMers(typename KmerCounter<C>::MerList & mers, size_t num, C threshold = 1, AbundanceHistogram * histogram = nullptr, CountTableWriter * table = nullptr) {
 
-			KmerError err = flushToCache();
+			KmerError err = this->flusher.wait();
+			if(err.isError()) return err;
+
+			//With nothing in the database yet the last flush sees every kmer's full count, so it can fill the
+			//histogram and leave the top keys to the top cache. Otherwise, or when the scan runs anyway for
+			//the count table, the database scan fills it.
+			AbundanceHistogram * flushHistogram = this->lastFlushSeesAll() && table == nullptr ? histogram : nullptr;
+
+			this->beginFlush();
+			err = flushToCache(hashTable, overflow, threshold, flushHistogram);
+			err |= this->endFlush();
 			if(err.isError()) return err;
 
 			std::vector<typename KeyCache<T,C>::EntryType> topEntries;
 
-			err = this->cache.getTopKeys(topEntries, num, threshold);
+			err = this->cache.getTopKeys(topEntries, num, threshold, flushHistogram ? nullptr : histogram, table);
+			if(err.isError()) return err;
 
 			mers.reserve(topEntries.size());
 
@@ -437,23 +987,70 @@ template <class T, typename C = size_t, class L = std::hash<T>> class UnorderedH
 
 		};
 
+		~UnorderedHashMerizedKmerCounter() { this->flusher.wait(); }; //flusher may still be working on flushTable
+
 	protected:
 
-		KmerError flushToCache(){
+		typedef std::integral_constant<bool, (sizeof(I) < sizeof(C))> IsCompact;
+		typedef ArenaAllocator<std::pair<const T, I>> Allocator;
+		typedef typename std::conditional<IsCompact::value, CompactCountTable<T, I, L>, std::unordered_map<T, I, L, std::equal_to<T>, Allocator>>::type Table;
+		typedef std::unordered_map<T, C, L> Overflow;
+
+		static Table newTable(Arena * arena, std::false_type) { return Table(Allocator(arena)); };
+		static Table newTable(Arena *, std::true_type) { return Table(); };
+
+		//The arena's blocks cover nodes and bucket arrays, including the ones abandoned by rehashing
+		template <class NodeTable> size_t getTableBytes(NodeTable & table) { return table.get_allocator().getArena()->getBytesReserved(); };
+		size_t getTableBytes(CompactCountTable<T, I, L> & table) { return table.getBytesReserved(); };
+
+		//A compact table doubles its slots when it grows, so it's flushed before a read would take it past
+		//the threshold rather than after, counting the rehash's peak. Node tables grow a little at a time and
+		//are checked after the read.
+		template <class NodeTable> bool hasRoomFor(NodeTable &, size_t) { return true; };
+		bool hasRoomFor(CompactCountTable<T, I, L> & table, size_t newEntries) {
+			return !this->flushOnBytes || table.empty() || table.getBytesToHold(table.size() + newEntries) <= this->flushOnBytes;
+		};
+
+		KmerError flushActive(){
+			return flushToCache(hashTable, overflow);
+		};
+
+		//Hand the full table to the flusher thread and keep counting into the (empty) spare one
+		KmerError swapAndFlush(){
+
+			KmerError err = this->flusher.wait();
+			if(err.isError()) return err;
+
+			this->beginFlush();
+			std::swap(hashTable, flushTable);
+			std::swap(overflow, flushOverflow);
+
+			return this->flusher.submit([this]() { KmerError err = flushToCache(flushTable, flushOverflow); err |= this->endFlush(); return err; });
+
+		};
+
+		//minNewCount is only passed on the last flush, see BaseKeyCache::incrementKey, and so is histogram
+		KmerError flushToCache(Table & table, Overflow & tableOverflow, C minNewCount = 0, AbundanceHistogram * histogram = nullptr){
+
+			KMER_STATS_SCOPE(Flush);
+			KMER_STATS_ADD(Flushes, 1);
+			KMER_STATS_ADD(FlushedEntries, table.size());
 
 			KmerError err;
 
 			typename KeyCache<T,C>::EntryType entry;
 
-			for(auto & i : hashTable){
+			for(auto && i : table){
 				entry.first = i.first;
-				entry.second = i.second;
+				entry.second = this->getCount(i.second, i.first, tableOverflow);
+				if(histogram) histogram->add(entry.second);
 
-				err = this->cache.incrementKey(entry);
+				err = this->cache.incrementKey(entry, minNewCount);
 				if(err.isError()) return err;
 			};
 
-			hashTable.clear();
+			this->releaseTable(table);
+			tableOverflow.clear();
 
 
 			return KmerError();
@@ -463,6 +1060,11 @@ template <class T, typename C = size_t, class L = std::hash<T>> class UnorderedH
 	private:
 
 
-		std::unordered_map<T, C, L> hashTable;
+		Table hashTable;
+		Table flushTable;
+		Overflow overflow;
+		Overflow flushOverflow;
+		size_t keyHeapBytes;
+		size_t overflowEntryBytes;
 
 };
@@ -0,0 +1,514 @@
+#include "kmerMerge.h"
+#include "kmerCounter.h"
+#include "countTable.h"
+#include "topSelector.h"
+#include "keyCodec.h"
+#include "scratchSpace.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+	//Keys stay packed for the whole merge and are only decoded for the output
+	typedef string PackedKey;
+
+	struct PackedLess {
+		bool operator()(const PackedKey & a, const PackedKey & b) const {
+			return KeyCodec::compare((const unsigned char *)a.data(), (const unsigned char *)b.data(), a.size()) < 0;
+		}
+	};
+
+	typedef TopSelector<PackedKey, uint64_t, PackedLess> Selector;
+	typedef KeyCache<vector<char>, size_t> Database;
+
+	//Sequential scans don't need much of a database mapped
+	const size_t scanMapSize = 64 * 1024 * 1024;
+
+	struct MergeInput {
+		string path;
+		unique_ptr<CountTableReader> table; //null for databases
+		size_t kmerWidth;
+		size_t countBytes;
+		size_t records;
+	};
+
+	uint64_t saturatingAdd(uint64_t a, uint64_t b, uint64_t maxCount) {
+		return maxCount - a < b ? maxCount : a + b;
+	}
+
+	//What one merge thread keeps: its share of the top kmers and, with an export, a batch of merged
+	//records that goes to the shared table writer under a lock.
+	class MergeSink {
+
+	public:
+
+		MergeSink(size_t topCount, size_t _keyBytes, CountTableWriter * _table, mutex & _tableLock)
+			:selector(topCount), distinct(0), keyBytes(_keyBytes), table(_table), tableLock(_tableLock) {};
+
+		void add(const unsigned char * key, uint64_t count) {
+
+			distinct++;
+
+			if (selector.isCandidate(count))
+				selector.offer(PackedKey((const char *)key, keyBytes), count);
+
+			if (table) {
+				keys.insert(keys.end(), key, key + keyBytes);
+				counts.push_back(count);
+				if (counts.size() >= batchRecords)
+					flush();
+			}
+
+		};
+
+		void flush() {
+
+			if (counts.empty())
+				return;
+
+			lock_guard<mutex> lock(tableLock);
+			for (size_t i = 0; i < counts.size(); i++)
+				table->add((const char *)&keys[i * keyBytes], keyBytes, counts[i]);
+
+			keys.clear();
+			counts.clear();
+
+		};
+
+		Selector selector;
+		size_t distinct;
+
+	private:
+
+		static const size_t batchRecords = 64 * 1024;
+
+		size_t keyBytes;
+		CountTableWriter * table;
+		mutex & tableLock;
+		vector<unsigned char> keys;
+		vector<uint64_t> counts;
+
+	};
+
+	//k-way merge of [begin, end) of every table, summing equal keys
+	void mergeRange(vector<MergeInput> & inputs, const vector<uint64_t> & begin, const vector<uint64_t> & end, size_t keyBytes, uint64_t maxCount, MergeSink & sink) {
+
+		vector<uint64_t> pos(begin);
+
+		auto keyAt = [&inputs, &pos](size_t i) { return inputs[i].table->getKey(pos[i]); };
+
+		//equal keys come out in input order, which doesn't matter for a sum but keeps it deterministic
+		auto later = [&keyAt, keyBytes](size_t a, size_t b) {
+			int c = KeyCodec::compare(keyAt(a), keyAt(b), keyBytes);
+			return c > 0 || (c == 0 && a > b);
+		};
+
+		priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+
+		for (size_t i = 0; i < inputs.size(); i++)
+			if (pos[i] < end[i])
+				heap.push(i);
+
+		while (!heap.empty()) {
+
+			size_t next = heap.top();
+			heap.pop();
+
+			const unsigned char * key = keyAt(next);
+			uint64_t count = inputs[next].table->getCount(pos[next]);
+			if (++pos[next] < end[next])
+				heap.push(next);
+
+			while (!heap.empty() && KeyCodec::compare(keyAt(heap.top()), key, keyBytes) == 0) {
+				size_t same = heap.top();
+				heap.pop();
+				count = saturatingAdd(count, inputs[same].table->getCount(pos[same]), maxCount);
+				if (++pos[same] < end[same])
+					heap.push(same);
+			}
+
+			sink.add(key, count);
+
+		}
+
+	}
+
+	//A hash partition's records from one routing thread, spilled to a scratch file as packed key and
+	//native count. The file is opened for each spill, so the number of partitions isn't bounded by
+	//the open file limit.
+	class PartitionSpill {
+
+	public:
+
+		PartitionSpill(string _path, size_t _bufferBytes) :path(_path), bufferBytes(_bufferBytes) {};
+
+		KmerError add(const char * key, size_t keyBytes, uint64_t count) {
+
+			buffer.append(key, keyBytes);
+			buffer.append((const char *)&count, sizeof(count));
+
+			if (buffer.size() >= bufferBytes)
+				return flush();
+
+			return KmerError();
+
+		};
+
+		KmerError flush() {
+
+			if (buffer.empty())
+				return KmerError();
+
+			ofstream out(path.c_str(), ios_base::binary | ios_base::app);
+			out.write(buffer.data(), buffer.size());
+			if (out.fail())
+				return KmerError(1, "Error writing merge partition " + path);
+
+			buffer.clear();
+			return KmerError();
+
+		};
+
+	private:
+
+		string path;
+		size_t bufferBytes;
+		string buffer;
+
+	};
+
+	KmerError openInput(string path, MergeInput & input) {
+
+		input.path = path;
+
+		if (CountTableReader::isCountTable(path)) {
+			input.table.reset(new CountTableReader(path));
+			input.kmerWidth = input.table->getHeader().kmerWidth;
+			input.countBytes = input.table->getHeader().countBytes;
+			input.records = input.table->getEntryCount();
+			return KmerError();
+		}
+
+		Database database(path, false, 0, scanMapSize, false, 0, Database::Read);
+		input.kmerWidth = database.getKmerWidth();
+		input.countBytes = database.getCountBytes();
+		input.records = database.getRecordCount();
+
+		if (input.kmerWidth == 0)
+			return KmerError(1, "Database " + path + " doesn't record its kmer width");
+
+		return KmerError();
+
+	}
+
+}
+
+KmerError KmerUtils::runMerge(MergeParams & params) {
+
+	try {
+
+		if (params.inputPaths.empty())
+			return KmerError(1, "Nothing to merge");
+
+		vector<MergeInput> inputs(params.inputPaths.size());
+		KmerError err;
+
+		size_t countBytes = 0;
+		size_t totalRecords = 0;
+		bool sorted = true;
+
+		for (size_t i = 0; i < inputs.size(); i++) {
+
+			err = openInput(params.inputPaths[i], inputs[i]);
+			if (err.isError()) return err;
+
+			if (inputs[i].kmerWidth != inputs[0].kmerWidth)
+				return KmerError(1, inputs[i].path + " holds " + to_string(inputs[i].kmerWidth) + "-mers, " + inputs[0].path + " holds " + to_string(inputs[0].kmerWidth) + "-mers");
+
+			countBytes = max(countBytes, inputs[i].countBytes);
+			totalRecords += inputs[i].records;
+			sorted &= inputs[i].table != nullptr;
+
+		}
+
+		size_t kmerWidth = inputs[0].kmerWidth;
+		size_t keyBytes = KeyCodec::packedBytes(kmerWidth);
+		uint64_t maxCount = countBytes >= sizeof(uint64_t) ? numeric_limits<uint64_t>::max() : ((uint64_t)1 << (8 * countBytes)) - 1;
+
+		size_t threads = params.threads ? params.threads : max(1u, thread::hardware_concurrency());
+
+		//One budget for everything held at once: an export's runs get half of it, the hash partitions the rest
+		size_t tableBudget = params.exportPath.size() != 0 ? params.memoryBudget / 2 : 0;
+		size_t mergeBudget = params.memoryBudget - tableBudget;
+
+		unique_ptr<CountTableWriter> table;
+		if (params.exportPath.size() != 0)
+			table.reset(new CountTableWriter(params.exportPath, kmerWidth, countBytes, params.exportIndexStride, tableBudget));
+
+		mutex tableLock;
+		vector<unique_ptr<MergeSink>> sinks;
+		vector<KmerError> errors(threads);
+		vector<thread> workers;
+
+		for (size_t t = 0; t < threads; t++)
+			sinks.emplace_back(new MergeSink(params.topCount, keyBytes, table.get(), tableLock));
+
+		//Shared with the workers, so they live until the join below
+		vector<vector<uint64_t>> bounds(threads + 1, vector<uint64_t>(inputs.size(), 0));
+		size_t partitions = 0;
+		atomic<size_t> nextPartition(0);
+		unique_ptr<ScratchSpace> scratch; //hash merge spills
+		auto spillPath = [&scratch](size_t partition, size_t router, string & path) {
+			return scratch->getPath(partition, "merge." + to_string(partition) + "." + to_string(router), path);
+		};
+
+		if (sorted) {
+
+			//Cut points at evenly spaced keys of the largest table, located in every table
+			size_t largest = 0;
+			for (size_t i = 0; i < inputs.size(); i++)
+				if (inputs[i].records > inputs[largest].records)
+					largest = i;
+
+			for (size_t i = 0; i < inputs.size(); i++)
+				bounds[threads][i] = inputs[i].records;
+
+			for (size_t t = 1; t < threads; t++) {
+				const unsigned char * split = inputs[largest].table->getKey(inputs[largest].records * t / threads);
+				for (size_t i = 0; i < inputs.size(); i++)
+					bounds[t][i] = inputs[largest].records ? inputs[i].table->lowerBound(split) : 0;
+			}
+
+			params.outputTerminal << "Merging " << inputs.size() << " sorted count tables in " << threads << " key ranges" << endl;
+
+			for (size_t t = 0; t < threads; t++)
+				workers.emplace_back([&, t]() {
+
+					try {
+						mergeRange(inputs, bounds[t], bounds[t + 1], keyBytes, maxCount, *sinks[t]);
+						sinks[t]->flush();
+					}
+					catch (KmerError & e) {
+						errors[t] = e;
+					}
+
+				});
+
+		}
+		else {
+
+			//A hash table entry costs its node, bucket and key
+			size_t entryBytes = sizeof(pair<const PackedKey, uint64_t>) + 3 * sizeof(void *) + (keyBytes >= sizeof(PackedKey) / 2 ? keyBytes + 1 : 0);
+			size_t perThread = max<size_t>(1, mergeBudget / threads);
+			partitions = max(threads, (totalRecords * entryBytes + perThread - 1) / perThread);
+
+			//Every routing thread buffers a spill per partition, together they get the budget
+			size_t recordBytes = keyBytes + sizeof(uint64_t);
+			size_t spillBytes = max(recordBytes, min<size_t>(1024 * 1024, mergeBudget / (threads * partitions)));
+
+			params.outputTerminal << "Merging " << inputs.size() << " inputs in " << partitions << " hash partitions on " << threads << " threads" << endl;
+
+			scratch.reset(new ScratchSpace(params.tmpDirs));
+
+			//Each input is scanned once, by one thread, and its records routed to their partition's spill
+			atomic<size_t> nextInput(0);
+
+			for (size_t t = 0; t < threads; t++)
+				workers.emplace_back([&, t]() {
+
+					try {
+
+						vector<PartitionSpill> spills;
+						for (size_t p = 0; p < partitions; p++) {
+							string path;
+							errors[t] = spillPath(p, t, path);
+							if (errors[t].isError()) return;
+							spills.emplace_back(path, spillBytes);
+						}
+
+						KmerError routeErr;
+						auto route = [&](const char * key, uint64_t count) {
+							if (!routeErr.isError())
+								routeErr = spills[KeyCodec::hash((const unsigned char *)key, keyBytes) % partitions].add(key, keyBytes, count);
+						};
+
+						for (size_t i = nextInput++; i < inputs.size() && !routeErr.isError(); i = nextInput++) {
+
+							if (inputs[i].table) {
+								for (uint64_t r = 0; r < inputs[i].records; r++)
+									route((const char *)inputs[i].table->getKey(r), inputs[i].table->getCount(r));
+								continue;
+							}
+
+							//Kyoto serializes scans of one handle, so every thread opens its own
+							Database database(inputs[i].path, false, 0, scanMapSize, false, kmerWidth, Database::Read);
+							KmerError scanErr = database.scanCounts([&](const char * key, size_t size, size_t count) {
+								if (size == keyBytes)
+									route(key, count);
+							});
+							if (scanErr.isError())
+								routeErr = scanErr;
+
+						}
+
+						for (size_t p = 0; p < partitions && !routeErr.isError(); p++)
+							routeErr = spills[p].flush();
+
+						errors[t] = routeErr;
+
+					}
+					catch (KmerError & e) {
+						errors[t] = e;
+					}
+
+				});
+
+			for (auto & w : workers)
+				w.join();
+			workers.clear();
+
+			bool routed = true;
+			for (auto & e : errors)
+				routed &= !e.isError();
+
+			//Then each thread sums one partition at a time from its spills
+			for (size_t t = 0; routed && t < threads; t++)
+				workers.emplace_back([&, t]() {
+
+					unordered_map<PackedKey, uint64_t> sums;
+					vector<char> chunk(max<size_t>(1, spillBytes / recordBytes) * recordBytes);
+
+					for (size_t p = nextPartition++; p < partitions; p = nextPartition++) {
+
+						for (size_t router = 0; router < threads; router++) {
+
+							string path;
+							errors[t] = spillPath(p, router, path);
+							if (errors[t].isError()) return;
+
+							ifstream in(path.c_str(), ios_base::binary);
+							if (!in.is_open())
+								continue; //nothing was routed to it
+
+							while (in) {
+
+								in.read(chunk.data(), chunk.size());
+								size_t records = (size_t)in.gcount() / recordBytes;
+
+								for (size_t r = 0; r < records; r++) {
+									const char * record = chunk.data() + r * recordBytes;
+									uint64_t count;
+									memcpy(&count, record + keyBytes, sizeof(count));
+									uint64_t & sum = sums[PackedKey(record, keyBytes)];
+									sum = saturatingAdd(sum, count, maxCount);
+								}
+
+							}
+
+							bool failed = in.bad();
+							in.close();
+							remove(path.c_str());
+
+							if (failed) {
+								errors[t] = KmerError(1, "Error reading merge partition " + path);
+								return;
+							}
+
+						}
+
+						for (auto & s : sums)
+							sinks[t]->add((const unsigned char *)s.first.data(), s.second);
+
+						sums.clear();
+
+					}
+
+					sinks[t]->flush();
+
+				});
+
+		}
+
+		for (auto & w : workers)
+			w.join();
+
+		//Spills left over by a failed merge
+		if (scratch)
+			for (size_t p = 0; p < partitions; p++)
+				for (size_t t = 0; t < threads; t++) {
+					string path;
+					if (!spillPath(p, t, path).isError())
+						remove(path.c_str());
+				}
+
+		for (auto & e : errors)
+			if (e.isError()) return e;
+
+		//Every thread saw different kmers, so the overall winners are among theirs
+		Selector selector(params.topCount);
+		size_t distinct = 0;
+		vector<Selector::Entry> entries;
+
+		for (auto & s : sinks) {
+			distinct += s->distinct;
+			s->selector.getSorted(entries);
+			for (auto & e : entries)
+				selector.offer(e.first, e.second);
+		}
+
+		selector.getSorted(entries);
+
+		if (table) {
+			err = table->finish();
+			if (err.isError()) return err;
+		}
+
+		string output;
+		output.reserve(entries.size() * (kmerWidth + 22));
+		vector<char> encoded;
+
+		for (auto & e : entries) {
+			KeyCodec::unpack((const unsigned char *)e.first.data(), kmerWidth, encoded);
+			err = KmerCounter<>::appendDecodedSequence(encoded, output);
+			if (err.isError()) return err;
+			output += ",";
+			output += to_string(e.second);
+			output += "\n";
+		}
+
+		if (params.outputPath.empty())
+			params.outputTerminal << output << flush;
+		else {
+			ofstream out(params.outputPath.c_str(), ios_base::binary);
+			out << output;
+			if (out.fail())
+				return KmerError(1, "Error writing merged top kmers to " + params.outputPath);
+		}
+
+		params.outputTerminal << "Merged " << distinct << " distinct kmers from " << totalRecords << " records" << endl;
+
+		if (entries.size() < params.topCount)
+			params.outputTerminal << "Warning. Specified top " << params.topCount << " of kmers, only " << entries.size() << " were found." << endl;
+
+		if (table)
+			params.outputTerminal << "Count table of " << table->getEntryCount() << " kmers (" << table->getFileSize() / (1024.0 * 1024.0) << " MB) written to " << params.exportPath << endl;
+
+	}
+	catch (KmerError & e) {
+		return e;
+	}
+
+	return KmerError();
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "kmerError.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+//merge subcommand: combines the counts of several runs, e.g. one per cluster node, from count tables
+//written with --export and databases kept with --keep-db or --append-to.
+namespace KmerUtils {
+
+	struct MergeParams {
+
+		std::ostream & outputTerminal;
+		std::vector<std::string> inputPaths;
+		size_t topCount;
+		std::string outputPath; //empty writes the top kmers to the terminal
+		std::string exportPath; //count table of every merged kmer, empty skips it
+		size_t exportIndexStride;
+		size_t threads; //0 uses every core
+		size_t memoryBudget; //for the hash merge's partition tables and the export runs
+		std::vector<std::string> tmpDirs; //where the hash merge spills its partitions, empty uses $TMPDIR
+
+		MergeParams(std::ostream & _outputTerminal) :outputTerminal(_outputTerminal), topCount(0), exportIndexStride(0), threads(0), memoryBudget((size_t)2 * 1024 * 1024 * 1024) {};
+
+	};
+
+	//Sums the counts of every kmer over all inputs (saturating at the widest input's counter), and
+	//writes the top kmers as "kmer,count" lines plus, optionally, a count table of all of them.
+	//
+	//When every input is a count table they're already sorted, so they're streamed through a k-way
+	//merge. The key space is cut into one range per thread at keys of the largest table, and each
+	//thread merges its range of every table. Otherwise records are hash partitioned: every input is
+	//scanned once and its records spilled to a scratch file per partition, then each thread takes a
+	//partition at a time and sums its spills in memory. There are as many partitions as it takes for
+	//one per thread to fit in the memory budget.
+	KmerError runMerge(MergeParams & params);
+
+};
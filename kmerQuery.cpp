@@ -0,0 +1,151 @@
+#include "kmerQuery.h"
+#include "kmerCounter.h"
+#include "countTable.h"
+#include "keyCodec.h"
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
+using namespace std;
+
+namespace {
+
+	KmerError readQueries(istream & in, vector<string> & queries) {
+
+		string line;
+		while (getline(in, line)) {
+
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+
+			if (line.empty())
+				continue;
+
+			if (!queries.empty() && line.size() != queries[0].size())
+				return KmerError(1, "Query " + line + " is not as long as the first query");
+
+			queries.push_back(line);
+
+		}
+
+		if (in.bad())
+			return KmerError(1, "Error reading queries");
+
+		return KmerError();
+
+	}
+
+	//Kyoto lookups don't care about order, but sorted batches keep repeated kmers together
+	KmerError lookupDatabase(string path, vector<vector<char>> & encoded, const vector<size_t> & order, vector<uint64_t> & counts) {
+
+		typedef KeyCache<vector<char>, size_t> Cache;
+
+		Cache cache(path, false, 0, Cache::defaultMapSize(), false, encoded[0].size(), Cache::Read);
+
+		vector<Cache::EntryType> entries;
+		entries.reserve(order.size());
+		for (auto i : order)
+			entries.emplace_back(encoded[i], 0);
+
+		auto err = cache.getCounts(entries);
+		if (err.isError()) return err;
+
+		counts.assign(encoded.size(), 0);
+		for (size_t i = 0; i < order.size(); i++)
+			counts[order[i]] = entries[i].second;
+
+		return KmerError();
+
+	}
+
+}
+
+KmerError KmerUtils::runQuery(QueryParams & params) {
+
+	try {
+
+		vector<string> queries;
+		KmerError err;
+
+		if (params.queryPath.empty() || params.queryPath == "-")
+			err = readQueries(cin, queries);
+		else {
+			ifstream in(params.queryPath.c_str(), ios_base::binary);
+			if (!in.is_open())
+				return KmerError(1, "Error opening queries " + params.queryPath);
+			err = readQueries(in, queries);
+		}
+
+		if (err.isError()) return err;
+
+		if (queries.empty())
+			return KmerError(1, "No queries given");
+
+		size_t kmerWidth = queries[0].size();
+		size_t keyBytes = KeyCodec::packedBytes(kmerWidth);
+
+		//Encode and pack every query once, then sort by packed key
+		vector<vector<char>> encoded(queries.size());
+		vector<unsigned char> packed(queries.size() * keyBytes);
+		vector<const unsigned char *> keys(queries.size());
+
+		for (size_t i = 0; i < queries.size(); i++) {
+			err = KmerCounter<>::encodeSequence(queries[i], encoded[i]);
+			if (err.isError()) return err;
+
+			KeyCodec::pack(encoded[i], &packed[i * keyBytes]);
+			keys[i] = &packed[i * keyBytes];
+		}
+
+		vector<size_t> order(queries.size());
+		iota(order.begin(), order.end(), 0);
+		sort(order.begin(), order.end(), [&keys, keyBytes](size_t a, size_t b) {
+			return KeyCodec::compare(keys[a], keys[b], keyBytes) < 0;
+		});
+
+		vector<uint64_t> counts;
+
+		if (CountTableReader::isCountTable(params.tablePath)) {
+
+			CountTableReader table(params.tablePath);
+
+			if (table.getHeader().kmerWidth != kmerWidth)
+				return KmerError(1, "Queries are " + to_string(kmerWidth) + "-mers, the table holds " + to_string(table.getHeader().kmerWidth) + "-mers");
+
+			table.lookup(keys, order, counts);
+
+		}
+		else {
+
+			err = lookupDatabase(params.tablePath, encoded, order, counts);
+			if (err.isError()) return err;
+
+		}
+
+		string output;
+		output.reserve(queries.size() * (kmerWidth + 12));
+
+		for (size_t i = 0; i < queries.size(); i++) {
+			output += queries[i];
+			output += ",";
+			output += to_string(counts[i]);
+			output += "\n";
+		}
+
+		if (params.outputPath.empty())
+			params.outputTerminal << output << flush;
+		else {
+			ofstream out(params.outputPath.c_str(), ios_base::binary);
+			out << output;
+			if (out.fail())
+				return KmerError(1, "Error writing query results to " + params.outputPath);
+		}
+
+	}
+	catch (KmerError & e) {
+		return e;
+	}
+
+	return KmerError();
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "kmerError.h"
+#include <iostream>
+#include <string>
+
+//query subcommand: counts of given kmers from a count table written with --export, or from a
+//database kept with --keep-db, without counting the input again.
+namespace KmerUtils {
+
+	struct QueryParams {
+
+		std::ostream & outputTerminal;
+		std::string tablePath;
+		std::string queryPath; //one kmer per line, empty or "-" reads stdin
+		std::string outputPath; //empty writes to the terminal
+
+		QueryParams(std::ostream & _outputTerminal) :outputTerminal(_outputTerminal) {};
+
+	};
+
+	//Writes a "kmer,count" line per query, in the order given, with 0 for kmers that were never seen.
+	//All queries are read and sorted first, so each lookup continues from the previous one and the
+	//cost grows with the number of queries rather than the size of the table.
+	KmerError runQuery(QueryParams & params);
+
+};
@@ -0,0 +1,107 @@
+#include "kmerStats.h"
+#include <fstream>
+
+using namespace std;
+
+static const char * stageNames[] = { "parse", "encode", "merize", "count", "flush", "topScan" };
+static const char * counterNames[] = { "bytes", "reads", "kmers", "flushes", "flushedEntries", "topCacheHits", "topCacheMisses", "topCacheUpdates" };
+
+KmerStats::KmerStats() {
+
+	for (auto & i : stageTime)
+		i = 0;
+
+	for (auto & i : counters)
+		i = 0;
+
+}
+
+KmerStats & KmerStats::get() {
+	static KmerStats stats;
+	return stats;
+}
+
+bool KmerStats::isEnabled() {
+#ifdef KMER_ENABLE_STATS
+	return true;
+#else
+	return false;
+#endif
+}
+
+double KmerStats::getStageSeconds(Stage stage) {
+	return stageTime[stage].load(memory_order_relaxed) / 1e9;
+}
+
+uint64_t KmerStats::getCount(Counter counter) {
+	return counters[counter].load(memory_order_relaxed);
+}
+
+string KmerStats::jsonString(const string & text) {
+
+	static const char * hex = "0123456789abcdef";
+
+	string rtn = "\"";
+
+	for (unsigned char c : text) {
+		if (c == '"' || c == '\\')
+			rtn += string("\\") + (char)c;
+		else if (c < 0x20)
+			rtn += string("\\u00") + hex[c >> 4] + hex[c & 0xf];
+		else
+			rtn += c;
+	}
+
+	return rtn + "\"";
+
+}
+
+KmerError KmerStats::writeJson(string path, double wallSeconds, map<string, string> & extra) {
+
+	if (!isEnabled())
+		return KmerError(1, "Statistics were compiled out. Rebuild with -DKMER_STATS=ON to use --stats-json");
+
+	ofstream out(path.c_str());
+	if (out.fail())
+		return KmerError(1, "Error opening stats file " + path);
+
+	out << "{" << endl;
+
+	for (auto & i : extra)
+		out << "  " << jsonString(i.first) << ": " << i.second << "," << endl;
+
+	out << "  \"wallSeconds\": " << wallSeconds << "," << endl;
+
+	//Stage times are summed over threads, so flush time overlaps the others when flushing in the background
+	out << "  \"stageSeconds\": {";
+	for (int i = 0; i < StageCount; i++)
+		out << (i ? ", " : "") << "\"" << stageNames[i] << "\": " << getStageSeconds((Stage)i);
+	out << "}," << endl;
+
+	out << "  \"counters\": {";
+	for (int i = 0; i < CounterCount; i++)
+		out << (i ? ", " : "") << "\"" << counterNames[i] << "\": " << getCount((Counter)i);
+	out << "}," << endl;
+
+	double seconds = wallSeconds > 0 ? wallSeconds : 1;
+	out << "  \"throughput\": {\"bytesPerSecond\": " << getCount(Bytes) / seconds
+		<< ", \"readsPerSecond\": " << getCount(Reads) / seconds
+		<< ", \"kmersPerSecond\": " << getCount(Kmers) / seconds << "}," << endl;
+
+	uint64_t flushes = getCount(Flushes);
+	out << "  \"flush\": {\"count\": " << flushes << ", \"entries\": " << getCount(FlushedEntries)
+		<< ", \"meanEntries\": " << (flushes ? (double)getCount(FlushedEntries) / flushes : 0) << "}," << endl;
+
+	uint64_t lookups = getCount(TopCacheHits) + getCount(TopCacheMisses);
+	out << "  \"topCache\": {\"hits\": " << getCount(TopCacheHits) << ", \"misses\": " << getCount(TopCacheMisses)
+		<< ", \"hitRate\": " << (lookups ? (double)getCount(TopCacheHits) / lookups : 0)
+		<< ", \"updates\": " << getCount(TopCacheUpdates) << "}" << endl;
+
+	out << "}" << endl;
+
+	if (out.fail())
+		return KmerError(1, "Error writing stats file " + path);
+
+	return KmerError();
+
+}
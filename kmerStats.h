@@ -0,0 +1,72 @@
+#pragma once
+
+#include "kmerError.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+
+//Per stage timing and throughput counters, reported with --stats-json.
+//
+//Stages are timed with KMER_STATS_SCOPE, which accumulates steady_clock time for the enclosing block,
+//and counted with KMER_STATS_ADD. Both compile to nothing unless KMER_ENABLE_STATS is defined (CMake
+//option KMER_STATS). Accumulators are relaxed atomics since the flusher thread reports too.
+#ifdef KMER_ENABLE_STATS
+#define KMER_STATS_CONCAT_(a, b) a##b
+#define KMER_STATS_CONCAT(a, b) KMER_STATS_CONCAT_(a, b)
+#define KMER_STATS_SCOPE(stage) KmerStats::Scope KMER_STATS_CONCAT(kmerStatsScope, __LINE__)(KmerStats::stage)
+#define KMER_STATS_ADD(counter, n) KmerStats::get().add(KmerStats::counter, n)
+#else
+#define KMER_STATS_SCOPE(stage)
+#define KMER_STATS_ADD(counter, n)
+#endif
+
+class KmerStats {
+
+public:
+
+	enum Stage { Parse, Encode, Merize, Count, Flush, TopScan, StageCount };
+	enum Counter { Bytes, Reads, Kmers, Flushes, FlushedEntries, TopCacheHits, TopCacheMisses, TopCacheUpdates, CounterCount };
+
+	static KmerStats & get();
+
+	static bool isEnabled();
+
+	void addTime(Stage stage, uint64_t nanoseconds) {
+		stageTime[stage].fetch_add(nanoseconds, std::memory_order_relaxed);
+	};
+
+	void add(Counter counter, uint64_t n) {
+		counters[counter].fetch_add(n, std::memory_order_relaxed);
+	};
+
+	double getStageSeconds(Stage stage);
+	uint64_t getCount(Counter counter);
+
+	//Writes the report. wallSeconds is the end to end time used for the rates, extra holds run
+	//parameters and results (already JSON encoded values) reported alongside the stages.
+	KmerError writeJson(std::string path, double wallSeconds, std::map<std::string, std::string> & extra);
+
+	//text as a quoted JSON string, with quotes, backslashes and control characters escaped
+	static std::string jsonString(const std::string & text);
+
+	class Scope {
+	public:
+		Scope(Stage _stage) :stage(_stage), start(std::chrono::steady_clock::now()) {};
+		~Scope() {
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			KmerStats::get().addTime(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		};
+	private:
+		Stage stage;
+		std::chrono::steady_clock::time_point start;
+	};
+
+private:
+
+	KmerStats();
+
+	std::atomic<uint64_t> stageTime[StageCount];
+	std::atomic<uint64_t> counters[CounterCount];
+
+};
@@ -1,8 +1,9 @@
 #include "kmerUtils.h"
+#include <unistd.h>
 
 using namespace std;
 
-KmerUtils::ProgramParams::ProgramParams(std::ostream & _outputTerminal) :outputTerminal(_outputTerminal) {};
+KmerUtils::ProgramParams::ProgramParams(std::ostream & _outputTerminal) :outputTerminal(_outputTerminal), threshold(0), memoryBudget(0), memoryLimit(0), diskLimit(0), histoMax(10000), exportIndexStride(0), appendDatabase(false), progressInterval(5), workers(1), checkpointInterval(600), resume(false), sampleFraction(1), maxReads(0), minQuality(0), dedupReads(0), merizeThreads(1) {};
 
 KmerError KmerUtils::getAllArguments(int argc, char * argv[], vector<string> & rtn) {
 
@@ -39,6 +40,85 @@ KmerError KmerUtils::getArgument(int idx, int argc, char * argv[], string & rtn)
 
 }
 
+//Moves "--name value" pairs out of args and into options. Positional arguments keep their order.
+KmerError KmerUtils::getOptions(vector<string> & args, map<string, string> & options) {
+
+	vector<string> positional;
+
+	for (size_t i = 0; i < args.size(); i++) {
+
+		if (args[i].compare(0, 2, "--") != 0) {
+			positional.push_back(args[i]);
+			continue;
+		}
+
+		if (i + 1 == args.size())
+			return KmerError(1, "Missing value for option " + args[i]);
+
+		options[args[i]] = args[i + 1];
+		i++;
+
+	}
+
+	args = positional;
+
+	return KmerError();
+
+}
+
+//Parses sizes such as 4096, 512M, 28G or 90% (of physical memory)
+KmerError KmerUtils::parseByteSize(string text, size_t & bytes) {
+
+	try {
+
+		size_t used = 0;
+		double value = stod(text, &used);
+		string suffix = text.substr(used);
+
+		if (value < 0)
+			return KmerError(1, "Invalid size : " + text);
+
+		double scale = 1;
+
+		if (suffix == "" || suffix == "B")
+			scale = 1;
+		else if (suffix == "K" || suffix == "k")
+			scale = 1024.0;
+		else if (suffix == "M" || suffix == "m")
+			scale = 1024.0 * 1024.0;
+		else if (suffix == "G" || suffix == "g")
+			scale = 1024.0 * 1024.0 * 1024.0;
+		else if (suffix == "T" || suffix == "t")
+			scale = 1024.0 * 1024.0 * 1024.0 * 1024.0;
+		else if (suffix == "%")
+			scale = (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGESIZE) / 100.0;
+		else
+			return KmerError(1, "Invalid size suffix : " + text);
+
+		bytes = (size_t)(value * scale);
+
+	}
+	catch (std::exception & e) {
+		return KmerError(1, "Invalid size : " + text);
+	}
+
+	return KmerError();
+
+}
+
+//Resident set size from /proc/self/statm, 0 where that isn't available
+size_t KmerUtils::getResidentBytes() {
+
+	ifstream statm("/proc/self/statm");
+
+	size_t totalPages = 0, residentPages = 0;
+	if (!(statm >> totalPages >> residentPages))
+		return 0;
+
+	return residentPages * (size_t)sysconf(_SC_PAGESIZE);
+
+}
+
 int KmerUtils::displayError(KmerError err, std::ostream & displayTo){
 
 	auto desc = err.getErrorDescriptions();
@@ -67,3 +147,67 @@ void KmerUtils::displayFastqEntry(FastqReader::FastqEntry & entry, std::ostream
 	return;
 
 }
+
+string KmerUtils::perKmerPath(string path, size_t kmerWidth) {
+
+	if (path.empty())
+		return path;
+
+	return path + ".k" + to_string(kmerWidth);
+
+}
+
+void KmerUtils::setupReader(ProgramParams & params, FastqReader & reader) {
+
+	reader.setMinQuality(params.minQuality);
+
+	if (params.sampleFraction >= 1)
+		return;
+
+	ReadSampler sampler(params.sampleFraction);
+	reader.setSampler([sampler](const string & seqID) { return sampler.keep(seqID); });
+
+}
+
+KmerError KmerUtils::finishDeduplication(ProgramParams & params, ReadDeduplicator * dedup) {
+
+	if (!dedup)
+		return KmerError();
+
+	KmerError err = dedup->drain();
+	if (err.isError()) return err;
+
+	params.outputTerminal << "Collapsed " << dedup->getReads() << " reads into " << dedup->getPassedOn() << " weighted ones" << endl;
+
+	return KmerError();
+
+}
+
+void KmerUtils::reportMasking(ProgramParams & params, FastqReader & reader) {
+
+	if (params.minQuality)
+		params.outputTerminal << "Masked " << reader.getMaskedBases() << " bases below quality " << params.minQuality << endl;
+
+}
+
+double KmerUtils::getSampleRate(ProgramParams & params, FastqReader & reader, istream & input, size_t inputBytes, size_t reads) {
+
+	if (params.sampleFraction >= 1 && params.maxReads == 0)
+		return 1;
+
+	//Stopped by --max-reads before the end, the rest of the input is taken to look like what was scanned
+	double scanned = 1;
+	if (input.good() && inputBytes && input.tellg() > 0)
+		scanned = min(1.0, (double)input.tellg() / inputBytes);
+
+	double rate = params.sampleFraction * scanned;
+
+	params.outputTerminal << "Counted " << reads << " reads, skipped " << reader.getSkippedReads() << " by sampling, scanned "
+		<< scanned * 100 << "% of the input" << endl;
+
+	if (rate < 1)
+		params.outputTerminal << "Counts are scaled by " << 1 / rate << " and written as kmer,estimate,low,high with a 95% confidence interval" << endl;
+
+	return rate;
+
+}
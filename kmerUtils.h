@@ -4,32 +4,495 @@
 #include "fastqReader.h"
 #include <iostream>
 #include "kmerCounter.h"
+#include "kmerStats.h"
+#include "progressReporter.h"
+#include "workerPool.h"
+#include "readRouter.h"
+#include "scratchSpace.h"
+#include "checkpoint.h"
+#include "readBatchRing.h"
+#include "readSampler.h"
+#include "readDeduplicator.h"
 #include <fstream>
 #include <chrono>
+#include <map>
+#include <sstream>
+#include <thread>
 
 namespace KmerUtils {
 
 	KmerError getAllArguments(int argc, char * argv[], std::vector<std::string> & rtn);
 	KmerError getArgument(int idx, int argc, char * argv[], std::string & rtn);
+	KmerError getOptions(std::vector<std::string> & args, std::map<std::string, std::string> & options);
+	KmerError parseByteSize(std::string text, size_t & bytes);
+	size_t getResidentBytes();
 	int displayError(KmerError err, std::ostream & displayTo);
 	void displayFastqEntry(FastqReader::FastqEntry & entry, std::ostream & displayTo);
 
+	//Where one k of a run with several kmer sizes writes: path.k<kmerWidth>, empty when path is
+	std::string perKmerPath(std::string path, size_t kmerWidth);
+
+	struct ProgramParams;
+
+	//Hands --sample-fraction and --min-qual to the reader
+	void setupReader(ProgramParams & params, FastqReader & reader);
+
+	//Prints how many bases --min-qual masked
+	void reportMasking(ProgramParams & params, FastqReader & reader);
+
+	//Passes on the reads --dedup still holds and prints how many were collapsed. Nothing without dedup.
+	KmerError finishDeduplication(ProgramParams & params, ReadDeduplicator * dedup);
+
+	//Share of the input's reads that were counted, 1 without sampling: the sampled fraction of the part
+	//scanned before --max-reads stopped the run. Prints how the counts will be scaled.
+	double getSampleRate(ProgramParams & params, FastqReader & reader, std::istream & input, size_t inputBytes, size_t reads);
+
 	struct ProgramParams {
 
 		std::string outputLog;
 		std::ostream & outputTerminal;
 		std::string filePath;
 		size_t kmerWidth;
+		std::vector<size_t> kmerWidths; //every k of a run with several kmer sizes, kmerWidth is the first
 		size_t topCount;
-		size_t threshold;
+		size_t threshold; //--min-count, kmers seen fewer times are dropped from the database and the output
+		size_t memoryBudget;
+		size_t memoryLimit;
+		size_t diskLimit;
+		std::string statsPath;
+		std::string histoPath;
+		size_t histoMax;
+		std::string exportPath;
+		size_t exportIndexStride;
+		std::string keepDatabasePath;
+		bool appendDatabase; //--append-to adds to keepDatabasePath
+		double progressInterval;
+		std::string progressTextfile;
+		size_t workers; //--workers, processes each counting one hash partition of the kmers
+		std::vector<std::string> tmpDirs; //--tmp-dir, empty uses $TMPDIR
+		std::string checkpointPath; //--checkpoint or --resume
+		double checkpointInterval; //--checkpoint-interval, seconds between checkpoints
+		bool resume; //--resume continues from checkpointPath if it's there
+		double sampleFraction; //--sample-fraction, share of the reads counted, picked by read ID
+		size_t maxReads; //--max-reads, 0 for no limit
+		unsigned minQuality; //--min-qual, Phred score below which bases break kmers, 0 for none
+		size_t dedupReads; //--dedup, distinct reads held for duplicate collapsing, 0 for none
+		size_t merizeThreads; //--merize-threads, threads merizing the segments of long reads
 
 		ProgramParams(std::ostream & _outputTerminal);
 
 	};
 
+	//Orders decoded kmers the way their packed keys sort (G T C A N), like the counters break ties
+	struct DecodedKmerLess {
+		bool operator()(const std::string & a, const std::string & b) const {
+			static const std::string bases = "GTCAN";
+			for (size_t i = 0; i < a.size() && i < b.size(); i++)
+				if (a[i] != b[i])
+					return bases.find(a[i]) < bases.find(b[i]);
+			return a.size() < b.size();
+		}
+	};
+
+	//Body of a --workers process: counts the runs of its kmers arriving on input (see ReadRouter),
+	//then writes its top kmers as "kmer,count" lines followed by a "#" line of counter statistics.
+	//Errors are sent as a "!" line instead.
+	template <class CounterType> int countPartition(ProgramParams & params, size_t index, std::string scratchPath, PipeReader & input, int resultFd) {
+
+		std::string result;
+		KmerError err;
+
+		try {
+
+			//the machine's limits are shared between the workers
+			CounterSettings settings;
+			settings.memoryBudget = params.memoryBudget / params.workers;
+			settings.memoryLimit = params.memoryLimit / params.workers;
+			settings.diskLimit = params.diskLimit / params.workers;
+			settings.scratchPath = scratchPath;
+			settings.merizeThreads = params.merizeThreads;
+			CounterType counter(params.kmerWidth, settings);
+
+			std::string sequence;
+			while (!err.isError() && input.getLine(sequence)) {
+
+				//Reads collapsed by --dedup come with their multiplicity after a tab
+				size_t weight = 1;
+				size_t tab = params.dedupReads ? sequence.find('\t') : std::string::npos;
+				if (tab != std::string::npos) {
+					weight = std::stoull(sequence.substr(tab + 1));
+					sequence.resize(tab);
+				}
+
+				err = counter.addSequence(sequence, weight);
+			}
+
+			auto minCount = counter.getMaximumCount();
+			if (params.threshold < minCount)
+				minCount = params.threshold;
+
+			typename CounterType::MerList outMer;
+			if (!err.isError())
+				err = counter.getTopMers(outMer, params.topCount, minCount);
+
+			for (size_t i = 0; !err.isError() && i < outMer.size(); i++) {
+				err = counter.appendDecodedSequence(outMer[i].first, result);
+				result += "," + std::to_string(+outMer[i].second) + "\n";
+			}
+
+			result += "#" + std::to_string(counter.getFlushCount()) + " " + std::to_string(counter.getFlushTime()) + " " + std::to_string(counter.getPeakTableBytes())
+				+ " " + std::to_string(counter.getDatabaseSize()) + " " + std::to_string(counter.getMinCountSkipped()) + " " + std::to_string(+counter.getMaximumCount()) + "\n";
+
+		}
+		catch (KmerError & e) {
+			err = e;
+		}
+		catch (std::exception & e) {
+			//bad_alloc, a bad multiplicity... would otherwise end the worker without a word
+			err = KmerError(e);
+		}
+
+		if (err.isError())
+			result = "!" + err.getLastErrorDescription().second + "\n";
+
+		WorkerPool::writeAll(resultFd, result.data(), result.size());
+
+		return err.isError() ? 1 : 0;
+
+	}
+
+	//--workers coordinator: forks the workers, routes the runs of each read's kmers to their owners and
+	//merges their top kmers. Partitions don't share kmers, so the overall top N are among the workers' top N.
+	template <class CounterType> KmerError countPartitioned(ProgramParams & params) {
+
+		std::ofstream outputStream;
+
+		if (params.outputLog.size() != 0) {
+			outputStream.open(params.outputLog.c_str(), std::ios_base::binary);
+			if (outputStream.fail())
+				return KmerError(1, "Error opening output log");
+		};
+
+		std::ifstream inputStream(params.filePath.c_str(), std::ios_base::binary);
+		if (!inputStream.is_open())
+			return KmerError(1, "Error opening input file " + params.filePath);
+
+		inputStream.seekg(0, std::ios_base::end);
+		size_t inputBytes = inputStream.tellg() > 0 ? (size_t)inputStream.tellg() : 0;
+		inputStream.seekg(0, std::ios_base::beg);
+
+		//Worker databases are striped over the scratch directories. Declared before the pool, so the
+		//directories are only removed once the workers are gone. The paths are taken before forking,
+		//so the directories they create are known here.
+		ScratchSpace scratch(params.tmpDirs);
+		std::vector<std::string> databasePaths(params.workers);
+		for (size_t i = 0; i < params.workers; i++) {
+			KmerError err = scratch.getPath(i, "kmerCache." + std::to_string(i), databasePaths[i]);
+			if (err.isError()) return err;
+		}
+
+		//Fork before the progress thread exists
+		WorkerPool pool;
+		KmerError err = pool.start(params.workers, [&params, &databasePaths](size_t index, PipeReader & input, int resultFd) {
+			return countPartition<CounterType>(params, index, databasePaths[index], input, resultFd);
+		});
+		if (err.isError()) return err;
+
+		ProgressReporter progress(params.outputTerminal, params.progressInterval, inputBytes, params.progressTextfile, nullptr);
+
+		FastqReader reader(inputStream);
+		FastqReader::FastqEntry entry;
+		setupReader(params, reader);
+
+		//One line per run of a worker's kmers. Runs of collapsed reads are followed by their multiplicity.
+		ReadRouter router(params.kmerWidth, params.workers);
+		auto sendRead = [&pool, &router](const std::string & sequence, size_t weight) {
+			std::string suffix = weight > 1 ? "\t" + std::to_string(weight) + "\n" : "\n";
+			return router.route(sequence, [&pool, &suffix](size_t worker, const char * bases, size_t length) {
+				KmerError err = pool.send(worker, bases, length);
+				if (err.isError()) return err;
+				return pool.send(worker, suffix.data(), suffix.size());
+			});
+		};
+
+		std::unique_ptr<ReadDeduplicator> dedup;
+		if (params.dedupReads)
+			dedup.reset(new ReadDeduplicator(params.dedupReads, sendRead));
+
+		size_t count = 0;
+		size_t bytes = 0;
+		size_t kmers = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		KmerError sendErr;
+
+		while (inputStream.good() && (params.maxReads == 0 || count < params.maxReads)) {
+
+			err = reader.getEntry(entry);
+
+			if (reader.atEnd())
+				break;
+
+			if (err.isError()) return err;
+
+			count++;
+			bytes += reader.getEntryBytes();
+			if (entry.sequence.size() >= params.kmerWidth)
+				kmers += entry.sequence.size() - params.kmerWidth + 1;
+
+			sendErr = dedup ? dedup->add(entry.sequence) : sendRead(entry.sequence, 1);
+			if (sendErr.isError()) break;
+
+			progress.reads.store(count, std::memory_order_relaxed);
+			progress.bytes.store(bytes + reader.getSkippedBytes(), std::memory_order_relaxed);
+			progress.kmers.store(kmers, std::memory_order_relaxed);
+		}
+
+		double sampleRate = getSampleRate(params, reader, inputStream, inputBytes, count);
+		reportMasking(params, reader);
+
+		if (!sendErr.isError())
+			sendErr = finishDeduplication(params, dedup.get());
+
+		//Closing the input ends every worker's reads, even after one of them stopped reading.
+		//That one has its reason on its result pipe.
+		KmerError finishErr = pool.finishInput();
+		if (!sendErr.isError())
+			sendErr = finishErr;
+
+		params.outputTerminal << "Getting mers" << std::endl;
+		progress.setPhase("getting mers");
+
+		TopSelector<std::string, size_t, DecodedKmerLess> selector(params.topCount);
+		size_t flushes = 0, peakTableBytes = 0, databaseBytes = 0, minCountSkipped = 0, maximumCount = 0;
+		double flushTime = 0;
+		KmerError workerErr;
+
+		for (size_t i = 0; i < pool.size(); i++) {
+
+			std::string result;
+			workerErr |= pool.collect(i, result);
+
+			std::istringstream lines(result);
+			std::string line;
+			while (std::getline(lines, line)) {
+
+				if (line.empty())
+					continue;
+
+				if (line[0] == '!') {
+					KmerError failed(1, "Worker " + std::to_string(i) + " : " + line.substr(1));
+					workerErr |= failed;
+				}
+				else if (line[0] == '#') {
+					std::istringstream stats(line.substr(1));
+					size_t workerFlushes, workerPeak, workerDatabase, workerSkipped;
+					double workerFlushTime;
+					stats >> workerFlushes >> workerFlushTime >> workerPeak >> workerDatabase >> workerSkipped >> maximumCount;
+					flushes += workerFlushes;
+					flushTime += workerFlushTime;
+					peakTableBytes = std::max(peakTableBytes, workerPeak);
+					databaseBytes += workerDatabase;
+					minCountSkipped += workerSkipped;
+				}
+				else {
+					size_t comma = line.rfind(',');
+					try {
+						selector.offer(line.substr(0, comma), std::stoull(line.substr(comma + 1)));
+					}
+					catch (std::exception &) {
+						workerErr |= KmerError(1, "Worker " + std::to_string(i) + " sent a malformed result line : " + line);
+					}
+				}
+
+			}
+
+		}
+
+		workerErr |= pool.wait();
+		if (workerErr.isError()) return workerErr;
+		if (sendErr.isError()) return sendErr;
+
+		std::vector<TopSelector<std::string, size_t, DecodedKmerLess>::Entry> outMer;
+		selector.getSorted(outMer);
+
+		double duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (count == 0)
+			return KmerError(1, "Nothing read.");
+
+		params.outputTerminal << "Total time [s] : " << duration << std::endl;
+		params.outputTerminal << "Time per entry [ms] : " << duration / count * 1000.0 << std::endl;
+		params.outputTerminal << "Workers : " << pool.size() << std::endl;
+		params.outputTerminal << "Background flushes : " << flushes << " (" << flushTime << " s over all workers)" << std::endl;
+		params.outputTerminal << "Peak table memory per worker [MB] : " << peakTableBytes / (1024.0 * 1024.0) << std::endl;
+		params.outputTerminal << "Database size over all workers [MB] : " << databaseBytes / (1024.0 * 1024.0) << std::endl;
+
+		if (params.threshold > 1)
+			params.outputTerminal << "Kmers below min count dropped at the final flush : " << minCountSkipped << std::endl;
+
+		progress.setPhase("writing");
+
+		if (outMer.size() != params.topCount) {
+			params.outputTerminal << "Warning. Specified top " << params.topCount << " of kmers, only " << outMer.size() << " were found"
+				<< (params.threshold > 1 ? " at or above the min count." : ".") << std::endl;
+		}
+
+		bool foundSaturated = false;
+		std::string output;
+		output.reserve(outMer.size() * (params.kmerWidth + 22));
+
+		for (auto & i : outMer) {
+			foundSaturated |= i.second == maximumCount;
+			output += i.first;
+			if (sampleRate < 1)
+				ReadSampler::appendScaledCount(output, i.second, sampleRate);
+			else
+				output += "," + std::to_string(i.second);
+			output += "\n";
+		}
+
+		if (!outputStream.is_open())
+			params.outputTerminal << output << std::flush;
+		else
+			outputStream << output;
+
+		if (foundSaturated)
+			params.outputTerminal << "Warning, counters appear to be saturating. Consider increasing precision parameter." << std::endl;
+
+		return KmerError();
+
+	}
+
+	//The last flush and the top kmers, ordered by count (ties by key). The histogram and the count table
+	//are created and filled on the way when params asks for them.
+	template <class CounterType> KmerError collectCounts(ProgramParams & params, CounterType & counter, typename CounterType::MerList & outMer,
+		std::unique_ptr<AbundanceHistogram> & histogram, std::unique_ptr<CountTableWriter> & table) {
+
+		//Saturated counters still pass a minimum above what they can hold
+		auto minCount = counter.getMaximumCount();
+		if (params.threshold < minCount)
+			minCount = params.threshold;
+
+		//Filled by the last flush or the database scan that's needed for the top kmers anyway
+		if (params.histoPath.size() != 0)
+			histogram.reset(new AbundanceHistogram(params.histoMax, counter.getMaximumCount()));
+
+		//Sorted binary table of every kmer, fed by the same scan. Runs that don't fit in half the budget are spilled and merged.
+		if (params.exportPath.size() != 0)
+			table.reset(new CountTableWriter(params.exportPath, params.kmerWidth, sizeof(minCount), params.exportIndexStride,
+				params.memoryBudget ? params.memoryBudget / 2 : 256 * 1024 * 1024));
+
+		KmerError err = counter.getTopMers(outMer, params.topCount, minCount, histogram.get(), table.get());
+		if (err.isError()) return err;
+
+		if (table) {
+			err = table->finish();
+			if (err.isError()) return err;
+		}
+
+		return KmerError();
+
+	}
+
+	//Prints the run's figures and writes the top kmers to outputStream, or the terminal when it isn't open
+	template <class CounterType> KmerError reportCounts(ProgramParams & params, CounterType & counter, ProgressReporter & progress, std::ofstream & outputStream,
+		typename CounterType::MerList & outMer, AbundanceHistogram * histogram, CountTableWriter * table, size_t count, size_t resumedReads, double duration, double sampleRate) {
+
+		KmerError err;
+
+		if (count != 0) {
+			params.outputTerminal << "Total time [s] : " << duration << std::endl;
+			if (count > resumedReads)
+				params.outputTerminal << "Time per entry [ms] : " << duration / (count - resumedReads) * 1000.0 << std::endl;
+
+			//Background flushes overlap with counting. Only the stall time was added to the total above.
+			double flushTime = counter.getFlushTime();
+			double stallTime = counter.getFlushStallTime();
+			params.outputTerminal << "Background flushes : " << counter.getFlushCount() << std::endl;
+			params.outputTerminal << "Background flush time [s] : " << flushTime << " (" << std::max(0.0, flushTime - stallTime) << " hidden behind counting)" << std::endl;
+			params.outputTerminal << "Peak table memory [MB] : " << counter.getPeakTableBytes() / (1024.0 * 1024.0) << std::endl;
+			params.outputTerminal << "Database size [MB] : " << counter.getDatabaseSize() / (1024.0 * 1024.0) << std::endl;
+
+			if (counter.isAppending() && params.appendDatabase)
+				params.outputTerminal << "Counts added to the existing database " << params.keepDatabasePath << std::endl;
+
+			if (counter.getArenaAllocations())
+				params.outputTerminal << "Table allocations : " << counter.getArenaAllocations() << " served from " << counter.getArenaBlocks() << " arena blocks (~"
+					<< counter.getArenaSavedTime() << " s of malloc/free saved)" << std::endl;
+
+			params.outputTerminal << counter.getFootprint().getSummary();
+
+			if (params.threshold > 1)
+				params.outputTerminal << "Kmers below min count dropped at the final flush : " << counter.getMinCountSkipped()
+					<< " (~" << counter.getMinCountSkippedBytes() / (1024.0 * 1024.0) << " MB of database)" << std::endl;
+		}
+		else {
+			return KmerError(1, "Nothing read.");
+		}
+
+		size_t topReportedCount = std::min(params.topCount, outMer.size());
+
+		progress.setPhase("writing");
+
+		//Complain if there weren't enough kmers to create a full top kmer list
+		if (topReportedCount != params.topCount) {
+			params.outputTerminal << "Warning. Specified top " << params.topCount << " of kmers, only " << topReportedCount << " were found"
+				<< (params.threshold > 1 ? " at or above the min count." : ".") << std::endl;
+		}
+
+		auto saturatedCount = counter.getMaximumCount();
+		bool foundSaturated = false;
+
+		//Review top kmers. Check for saturated counters
+		std::string output;
+		output.reserve(topReportedCount * (params.kmerWidth + 22));
+
+		for (auto i = 0; i < topReportedCount; i++) {
+			err = counter.appendDecodedSequence(outMer[i].first, output);
+			if (err.isError()) return err;
+
+			if (outMer[i].second == saturatedCount)
+				foundSaturated = true;
+
+			if (sampleRate < 1)
+				ReadSampler::appendScaledCount(output, outMer[i].second, sampleRate);
+			else {
+				output += ",";
+				output += std::to_string(+outMer[i].second);
+			}
+			output += "\n";
+		}
+
+		if (!outputStream.is_open())
+			params.outputTerminal << output << std::flush;
+		else
+			outputStream << output;
+
+		if (table)
+			params.outputTerminal << "Count table of " << table->getEntryCount() << " kmers (" << table->getFileSize() / (1024.0 * 1024.0) << " MB) written to " << params.exportPath << std::endl;
+
+		if (histogram) {
+			err = histogram->write(params.histoPath, params.threshold);
+			if (err.isError()) return err;
+
+			params.outputTerminal << "Histogram of " << histogram->getDistinct() << " distinct kmers written to " << params.histoPath << std::endl;
+			foundSaturated |= histogram->getSaturated() != 0;
+		}
+
+		//Let user know they might want to rerun the application with larger accumulators
+		if (foundSaturated)
+			params.outputTerminal << "Warning, counters appear to be saturating. Consider increasing precision parameter." << std::endl;
+
+		return KmerError();
+
+	}
+
 	//Main program. Specialized by counter
 	template <class CounterType> KmerError countMers(ProgramParams & params) {
 
+		if (params.workers > 1)
+			return countPartitioned<CounterType>(params);
+
 		try {
 
 			std::ofstream outputStream;
@@ -48,90 +511,256 @@ namespace KmerUtils {
 			FastqReader reader(inputStream);
 
 			FastqReader::FastqEntry entry;
+			setupReader(params, reader);
+
+			//Checkpointed counts go to the kept database, or to one next to the checkpoint that is removed
+			//once the count is done. A scratch directory wouldn't be found again by --resume.
+			bool checkpointing = params.checkpointPath.size() != 0;
+			Checkpoint current;
+			std::vector<Checkpoint> resumable;
+			bool committedCheckpoint = false;
+
+			if (checkpointing) {
+
+				KmerError err = current.describeInput(params.filePath);
+				if (err.isError()) return err;
+				current.kmerWidth = params.kmerWidth;
+				current.minQuality = params.minQuality;
+				current.sampleFraction = params.sampleFraction;
+				current.maxReads = params.maxReads;
+				current.dedupReads = params.dedupReads;
+				current.databasePath = params.keepDatabasePath.empty() ? params.checkpointPath + ".kdb" : params.keepDatabasePath;
+
+				for (auto & path : { params.checkpointPath, Checkpoint::getPendingPath(params.checkpointPath) }) {
+
+					if (!params.resume) {
+						remove(path.c_str());
+						continue;
+					}
+
+					if (!Checkpoint::exists(path))
+						continue;
+
+					Checkpoint saved;
+					err = Checkpoint::read(path, saved);
+					if (err.isError()) return err;
+					resumable.push_back(saved);
+					committedCheckpoint |= path == params.checkpointPath;
+
+				}
+
+				if (params.resume && resumable.empty())
+					params.outputTerminal << "No checkpoint at " << params.checkpointPath << ", starting a new count" << std::endl;
+
+			}
 
 			//Initialize kmer counter
-			CounterType counter(params.kmerWidth);
+			//Outlives the counter, which removes its database before the directory goes
+			std::unique_ptr<ScratchSpace> scratch;
+			if (params.keepDatabasePath.empty() && !checkpointing)
+				scratch.reset(new ScratchSpace(params.tmpDirs));
+
+			CounterSettings settings;
+			settings.memoryBudget = params.memoryBudget;
+			settings.memoryLimit = params.memoryLimit;
+			settings.diskLimit = params.diskLimit;
+			settings.databasePath = params.keepDatabasePath;
+			settings.appendDatabase = params.appendDatabase;
+			if (scratch) {
+				KmerError err = scratch->getPath(0, "kmerCache", settings.scratchPath);
+				if (err.isError()) return err;
+			}
+			if (checkpointing) {
+				settings.checkpoints = true;
+				settings.scratchPath = current.databasePath;
+				settings.appendDatabase |= !resumable.empty();
+			}
+			settings.merizeThreads = params.merizeThreads;
+			CounterType counter(params.kmerWidth, settings);
+
+			//Size for the progress percentage and ETA
+			inputStream.seekg(0, std::ios_base::end);
+			size_t inputBytes = inputStream.tellg() > 0 ? (size_t)inputStream.tellg() : 0;
+			inputStream.seekg(0, std::ios_base::beg);
 
 			size_t count = 0;
+			size_t bytes = 0;
+			size_t kmers = 0;
+
+			//Continue from the checkpoint the database was committed at. Without one committed, a run that
+			//died before its first checkpoint left the database as it found it, so it starts over.
+			if (resumable.size()) {
+
+				current.countBytes = sizeof(counter.getMaximumCount());
+				auto saved = std::find_if(resumable.begin(), resumable.end(), [&counter](Checkpoint & i) { return i.generation == counter.getCheckpoint(); });
+
+				if (saved != resumable.end()) {
+
+					KmerError err = saved->matches(current);
+					if (err.isError()) return err;
+
+					inputStream.seekg(saved->offset, std::ios_base::beg);
+					if (saved->offset < inputBytes && inputStream.peek() != '@' && inputStream.peek() != '>')
+						return KmerError(1, "Checkpoint offset " + std::to_string(saved->offset) + " isn't at the start of a record");
+
+					count = saved->reads;
+					bytes = saved->offset;
+					kmers = saved->kmers;
+
+					params.outputTerminal << "Resuming from checkpoint " << saved->generation << " at read " << count << " (byte " << bytes << ")" << std::endl;
+
+				}
+				else if (committedCheckpoint)
+					return KmerError(1, "Database " + current.databasePath + " is at checkpoint " + std::to_string(counter.getCheckpoint()) + ", which " + params.checkpointPath + " doesn't describe");
+				else
+					params.outputTerminal << "No checkpoint was committed before the last run stopped, starting over" << std::endl;
+
+			}
+
+			//Flushes the counter and commits its database, then moves the new checkpoint in place. A crash
+			//in between leaves the pending one to be matched against the database's generation.
+			size_t resumedReads = count;
+
+			//--dedup holds distinct reads back until they're evicted, each is then counted once with its multiplicity
+			std::unique_ptr<ReadDeduplicator> dedup;
+			if (params.dedupReads)
+				dedup.reset(new ReadDeduplicator(params.dedupReads, [&counter, &params](const std::string & sequence, size_t weight) {
+					return counter.addSequence(sequence, weight, params.minQuality != 0);
+				}));
+
+			auto lastCheckpoint = std::chrono::steady_clock::now();
+			auto takeCheckpoint = [&]() {
+
+				//Reads held for deduplication are before the checkpoint's offset, they're counted first
+				if (dedup) {
+					KmerError err = dedup->drain();
+					if (err.isError()) return err;
+				}
+
+				current.countBytes = sizeof(counter.getMaximumCount());
+				current.generation = counter.getCheckpoint() + 1;
+				current.offset = inputStream.tellg();
+				current.reads = count;
+				current.kmers = kmers;
+
+				std::string pending = Checkpoint::getPendingPath(params.checkpointPath);
+				KmerError err = current.write(pending);
+				if (err.isError()) return err;
+
+				err = counter.checkpoint(current.generation);
+				if (err.isError()) return err;
+
+				if (rename(pending.c_str(), params.checkpointPath.c_str()) != 0)
+					return KmerError(1, "Unable to move checkpoint " + pending + " in place");
+
+				lastCheckpoint = std::chrono::steady_clock::now();
+				return KmerError();
+
+			};
+
+			//Declared after the counter so it stops sampling before the counter goes away
+			ProgressReporter progress(params.outputTerminal, params.progressInterval, inputBytes, params.progressTextfile,
+				[&counter](ProgressReporter::Sample & sample) {
+					sample.flushes = counter.getFlushCount();
+					sample.databaseBytes = counter.getDatabaseSize();
+				});
+
 			auto start = std::chrono::high_resolution_clock::now();
+			auto runStart = start;
 
 			KmerError err;
 
 			//This loop reads in from a FASTQ file until its empty
-			while (inputStream.good()) {
+			while (inputStream.good() && (params.maxReads == 0 || count < params.maxReads)) {
 
 				err = reader.getEntry(entry);
 
-				if (inputStream.eof())
+				if (reader.atEnd())
 					break;
 
 				if (err.isError()) {
 					return displayError(err, params.outputTerminal);
 				}
 
-				if (count % 10000 == 0) params.outputTerminal << "processed " << count << std::endl;
-
-				err |= counter.addSequence(entry.sequence);
+				err |= dedup ? dedup->add(entry.sequence) : counter.addSequence(entry.sequence, 1, params.minQuality != 0);
 				if (err.isError()) return err;
 				count++;
+
+				bytes += reader.getEntryBytes();
+				if (entry.sequence.size() >= params.kmerWidth)
+					kmers += entry.sequence.size() - params.kmerWidth + 1;
+
+				err = counter.getFootprint().update(Footprint::Reader, entry.seqID.capacity() + entry.sequence.capacity() + entry.alignment.capacity() + entry.quality.capacity()
+					+ (dedup ? dedup->getHeldBytes() : 0));
+				if (err.isError()) return err;
+
+				progress.reads.store(count, std::memory_order_relaxed);
+				progress.bytes.store(bytes + reader.getSkippedBytes(), std::memory_order_relaxed);
+				progress.kmers.store(kmers, std::memory_order_relaxed);
+
+				//the clock is only looked at every 1024 reads
+				if (checkpointing && (count & 1023) == 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - lastCheckpoint).count() >= params.checkpointInterval) {
+					progress.setPhase("checkpoint");
+					err = takeCheckpoint();
+					if (err.isError()) return err;
+					progress.setPhase("counting");
+				}
 			}
 
+			double sampleRate = getSampleRate(params, reader, inputStream, inputBytes, count);
+			reportMasking(params, reader);
+
+			err = finishDeduplication(params, dedup.get());
+			if (err.isError()) return err;
+
 			params.outputTerminal << "Getting mers" << std::endl;
+			progress.setPhase("getting mers");
 
-			//Get kmers, apply threshold to filter out small values and improve sort performance
+			//Top kmers come back selected and ordered by count (ties by key), only the winners are decoded
 			typename CounterType::MerList outMer;
+			std::unique_ptr<AbundanceHistogram> histogram;
+			std::unique_ptr<CountTableWriter> table;
 
-			err = counter.getTopMers(outMer, params.topCount, params.threshold);
+			err = collectCounts(params, counter, outMer, histogram, table);
 			if (err.isError()) return err;
 
+			//The finished count is committed, there's nothing left to resume
+			if (checkpointing) {
+				err = counter.checkpoint(counter.getCheckpoint() + 1);
+				if (err.isError()) return err;
+				if (params.keepDatabasePath.empty())
+					counter.removeDatabaseWhenDone();
+				remove(params.checkpointPath.c_str());
+				remove(Checkpoint::getPendingPath(params.checkpointPath).c_str());
+			}
+
 			auto end = std::chrono::high_resolution_clock::now();
 
 			double duration = std::chrono::duration<double>(end - start).count();
 
-			if (count != 0) {
-				params.outputTerminal << "Total time [s] : " << duration << std::endl;
-				params.outputTerminal << "Time per entry [ms] : " << duration / count * 1000.0 << std::endl;
-			}
-			else {
-				return KmerError(1, "Nothing read.");
-			}
-
-			//Sort kmers by frequency. Partial_sort will only sort enough of the array to get the top N elements
-			size_t topReportedCount = std::min(params.topCount, outMer.size());
-
-			start = std::chrono::high_resolution_clock::now();
-			std::partial_sort(outMer.begin(), outMer.begin() + topReportedCount, outMer.end(), CounterType::MerListSortByFrequency);
-			end = std::chrono::high_resolution_clock::now();
-			duration = std::chrono::duration<double>(end - start).count();
-			//params.outputTerminal << "Sorting time [s] : " << duration << std::endl;
+			err = reportCounts(params, counter, progress, outputStream, outMer, histogram.get(), table.get(), count, resumedReads, duration, sampleRate);
+			if (err.isError()) return err;
 
-			//Complain if there weren't enough kmers to create a full top kmer list
-			if (topReportedCount != params.topCount) {
-				params.outputTerminal << "Warning. Specified top " << params.topCount << " of kmers, only " << topReportedCount << " were found." << std::endl;
-			}
+			if (params.statsPath.size() != 0) {
 
-			auto saturatedCount = counter.getMaximumCount();
-			bool foundSaturated = false;
+				std::map<std::string, std::string> run;
+				run["input"] = KmerStats::jsonString(params.filePath);
+				run["kmerWidth"] = std::to_string(params.kmerWidth);
+				run["topCount"] = std::to_string(params.topCount);
+				run["memoryBudget"] = std::to_string(params.memoryBudget);
+				run["peakTableBytes"] = std::to_string(counter.getPeakTableBytes());
+				run["databaseBytes"] = std::to_string(counter.getDatabaseSize());
+				run["flushStallSeconds"] = std::to_string(counter.getFlushStallTime());
+				run["footprint"] = counter.getFootprint().getJson();
+				run["minCount"] = std::to_string(params.threshold);
+				run["minCountSkipped"] = std::to_string(counter.getMinCountSkipped());
+				run["minCountSkippedBytes"] = std::to_string(counter.getMinCountSkippedBytes());
 
-			//Review top kmers. Check for saturated counters
-			for (auto i = 0; i < topReportedCount; i++) {
-				std::string seq;
-				err = counter.decodeSequence(outMer[i].first, seq);
+				double wallTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - runStart).count();
+				err = KmerStats::get().writeJson(params.statsPath, wallTime, run);
 				if (err.isError()) return err;
-
-				if (outMer[i].second == saturatedCount)
-					foundSaturated = true;
-
-				if (!outputStream.is_open())
-					params.outputTerminal << seq << "," << +outMer[i].second << std::endl;
-				else
-					outputStream << seq << "," << +outMer[i].second << std::endl;
 			}
 
-			//Let user know they might want to rerun the application with larger accumulators
-			if (foundSaturated)
-				params.outputTerminal << "Warning, counters appear to be saturating. Consider increasing precision parameter." << std::endl;
-
 		}
 		catch (KmerError & e) {
 			//Just in case something is thrown
@@ -142,59 +771,60 @@ namespace KmerUtils {
 
 	}
 
-	//This function determines the type of counter to use in the program given the counter type and kmer width
-	template <typename Precision> KmerError createProgram(char counterType, ProgramParams & params) {
+	//This function determines the type of counter to use in the program given the counter type and kmer width,
+	//and calls action.run<CounterType>() with it. InlinePrecision narrower than Precision selects adaptive counters.
+	template <typename Precision, typename InlinePrecision, class Action> KmerError withCounterType(char counterType, size_t kmerWidth, Action & action) {
 
 
 		switch (counterType) {
 
 		case 0: //Sort
 
-			if (params.kmerWidth < 3)
-				return countMers<SortMerizedKmerCounter<std::array<unsigned char, 1>, Precision>>(params);
-			else if (params.kmerWidth < 6)
-				return countMers<SortMerizedKmerCounter<std::array<unsigned short, 1>, Precision>>(params);
-			else if (params.kmerWidth < 11)
-				return countMers<SortMerizedKmerCounter<std::array<unsigned int, 1>, Precision>>(params);
-			else if (params.kmerWidth < 22)
-				return countMers<SortMerizedKmerCounter<std::array<unsigned int, 2>, Precision>>(params);
-			else if (params.kmerWidth < 43)
-				return countMers<SortMerizedKmerCounter<std::array<size_t, 2>, Precision>>(params);
+			if (kmerWidth < 3)
+				return action.template run<SortMerizedKmerCounter<std::array<unsigned char, 1>, Precision, std::greater<std::array<unsigned char, 1>>, InlinePrecision>>();
+			else if (kmerWidth < 6)
+				return action.template run<SortMerizedKmerCounter<std::array<unsigned short, 1>, Precision, std::greater<std::array<unsigned short, 1>>, InlinePrecision>>();
+			else if (kmerWidth < 11)
+				return action.template run<SortMerizedKmerCounter<std::array<unsigned int, 1>, Precision, std::greater<std::array<unsigned int, 1>>, InlinePrecision>>();
+			else if (kmerWidth < 22)
+				return action.template run<SortMerizedKmerCounter<std::array<unsigned int, 2>, Precision, std::greater<std::array<unsigned int, 2>>, InlinePrecision>>();
+			else if (kmerWidth < 43)
+				return action.template run<SortMerizedKmerCounter<std::array<size_t, 2>, Precision, std::greater<std::array<size_t, 2>>, InlinePrecision>>();
 			else
-				return countMers<SortMerizedKmerCounter<std::vector<char>, Precision>>(params);
+				return action.template run<SortMerizedKmerCounter<std::vector<char>, Precision, std::greater<std::vector<char>>, InlinePrecision>>();
 			break;
 
 		case 1: //Map
 
-			if (params.kmerWidth < 3)
-				return countMers<HashMerizedKmerCounter<std::array<unsigned char, 1>, Precision>>(params);
-			else if (params.kmerWidth < 6)
-				return countMers<HashMerizedKmerCounter<std::array<unsigned short, 1>, Precision>>(params);
-			else if (params.kmerWidth < 11)
-				return countMers<HashMerizedKmerCounter<std::array<unsigned int, 1>, Precision>>(params);
-			else if (params.kmerWidth < 22)
-				return countMers<HashMerizedKmerCounter<std::array<unsigned int, 2>, Precision>>(params);
-			else if (params.kmerWidth < 43)
-				return countMers<HashMerizedKmerCounter<std::array<size_t, 2>, Precision>>(params);
+			if (kmerWidth < 3)
+				return action.template run<HashMerizedKmerCounter<std::array<unsigned char, 1>, Precision, std::greater<std::array<unsigned char, 1>>, InlinePrecision>>();
+			else if (kmerWidth < 6)
+				return action.template run<HashMerizedKmerCounter<std::array<unsigned short, 1>, Precision, std::greater<std::array<unsigned short, 1>>, InlinePrecision>>();
+			else if (kmerWidth < 11)
+				return action.template run<HashMerizedKmerCounter<std::array<unsigned int, 1>, Precision, std::greater<std::array<unsigned int, 1>>, InlinePrecision>>();
+			else if (kmerWidth < 22)
+				return action.template run<HashMerizedKmerCounter<std::array<unsigned int, 2>, Precision, std::greater<std::array<unsigned int, 2>>, InlinePrecision>>();
+			else if (kmerWidth < 43)
+				return action.template run<HashMerizedKmerCounter<std::array<size_t, 2>, Precision, std::greater<std::array<size_t, 2>>, InlinePrecision>>();
 			else
-				return countMers<HashMerizedKmerCounter<std::vector<char>, Precision>>(params);
+				return action.template run<HashMerizedKmerCounter<std::vector<char>, Precision, std::greater<std::vector<char>>, InlinePrecision>>();
 
 			break;
 
 		case 2: //Unordered map
 
-			if (params.kmerWidth < 3)
-				return countMers<UnorderedHashMerizedKmerCounter<std::array<unsigned char, 1>, Precision, ArrayHasher<unsigned char, 1>>>(params);
-			else if (params.kmerWidth < 6)
-				return countMers<UnorderedHashMerizedKmerCounter<std::array<unsigned short, 1>, Precision, ArrayHasher<unsigned short, 1>>>(params);
-			else if (params.kmerWidth < 11)
-				return countMers<UnorderedHashMerizedKmerCounter<std::array<unsigned int, 1>, Precision, ArrayHasher<unsigned int, 1>>>(params);
-			else if (params.kmerWidth < 22)
-				return countMers<UnorderedHashMerizedKmerCounter<std::array<unsigned int, 2>, Precision, ArrayHasher<unsigned int, 2>>>(params);
-			else if (params.kmerWidth < 43)
-				return countMers<UnorderedHashMerizedKmerCounter<std::array<size_t, 2>, Precision, ArrayHasher<size_t, 2>>>(params);
+			if (kmerWidth < 3)
+				return action.template run<UnorderedHashMerizedKmerCounter<std::array<unsigned char, 1>, Precision, ArrayHasher<unsigned char, 1>, InlinePrecision>>();
+			else if (kmerWidth < 6)
+				return action.template run<UnorderedHashMerizedKmerCounter<std::array<unsigned short, 1>, Precision, ArrayHasher<unsigned short, 1>, InlinePrecision>>();
+			else if (kmerWidth < 11)
+				return action.template run<UnorderedHashMerizedKmerCounter<std::array<unsigned int, 1>, Precision, ArrayHasher<unsigned int, 1>, InlinePrecision>>();
+			else if (kmerWidth < 22)
+				return action.template run<UnorderedHashMerizedKmerCounter<std::array<unsigned int, 2>, Precision, ArrayHasher<unsigned int, 2>, InlinePrecision>>();
+			else if (kmerWidth < 43)
+				return action.template run<UnorderedHashMerizedKmerCounter<std::array<size_t, 2>, Precision, ArrayHasher<size_t, 2>, InlinePrecision>>();
 			else
-				return countMers<UnorderedHashMerizedKmerCounter<std::vector<char>, Precision, VectorHasher<char>>>(params);
+				return action.template run<UnorderedHashMerizedKmerCounter<std::vector<char>, Precision, VectorHasher<char>, InlinePrecision>>();
 
 			break;
 
@@ -205,4 +835,297 @@ namespace KmerUtils {
 
 	}
 
+	//One k of a run with several kmer sizes. Hides the counter type, which depends on k.
+	class KmerSizeRun {
+
+	public:
+
+		//Called on the run's own counting thread
+		virtual KmerError add(const std::vector<char> & encoded, size_t weight) = 0;
+
+		//Last flush, report and output, see collectCounts and reportCounts
+		virtual KmerError finish(ProgressReporter & progress, size_t reads, double duration, double sampleRate) = 0;
+
+		virtual size_t getFlushCount() = 0;
+		virtual size_t getDatabaseSize() = 0;
+		virtual Footprint & getFootprint() = 0;
+
+		virtual ~KmerSizeRun() {};
+
+	};
+
+	template <class CounterType> class CounterRun : public KmerSizeRun {
+
+	public:
+
+		//params are this k's, with its own output paths
+		CounterRun(ProgramParams & _params, CounterSettings settings) :params(_params), counter(params.kmerWidth, settings) {
+
+			if (params.outputLog.size() != 0) {
+				outputStream.open(params.outputLog.c_str(), std::ios_base::binary);
+				if (outputStream.fail())
+					throw KmerError(1, "Error opening output log " + params.outputLog);
+			}
+
+		};
+
+		KmerError add(const std::vector<char> & encoded, size_t weight) {
+			return counter.addEncodedSequence(encoded, weight);
+		};
+
+		KmerError finish(ProgressReporter & progress, size_t reads, double duration, double sampleRate) {
+
+			typename CounterType::MerList outMer;
+			std::unique_ptr<AbundanceHistogram> histogram;
+			std::unique_ptr<CountTableWriter> table;
+
+			KmerError err = collectCounts(params, counter, outMer, histogram, table);
+			if (err.isError()) return err;
+
+			return reportCounts(params, counter, progress, outputStream, outMer, histogram.get(), table.get(), reads, 0, duration, sampleRate);
+
+		};
+
+		size_t getFlushCount() { return counter.getFlushCount(); };
+		size_t getDatabaseSize() { return counter.getDatabaseSize(); };
+		Footprint & getFootprint() { return counter.getFootprint(); };
+
+	private:
+
+		ProgramParams params;
+		std::ofstream outputStream;
+		CounterType counter;
+
+	};
+
+	struct AddKmerSizeAction {
+		ProgramParams & params;
+		CounterSettings & settings;
+		std::vector<std::unique_ptr<KmerSizeRun>> & runs;
+		template <class CounterType> KmerError run() {
+			runs.emplace_back(new CounterRun<CounterType>(params, settings));
+			return KmerError();
+		};
+	};
+
+	//Several kmer sizes in one pass. The input is parsed, validated and encoded once, then every k counts
+	//the same encoded reads on its own thread, fed batches through a ReadBatchRing. Each k has its own
+	//counter and database, with the memory and disk limits split between them, and writes its own output,
+	//histogram and count table (see perKmerPath).
+	template <typename Precision, typename InlinePrecision> KmerError countKmerSizes(char counterType, ProgramParams & params) {
+
+		static const size_t batchReads = 1024;
+
+		try {
+
+			//Attempt to open fastqFile
+			std::ifstream inputStream(params.filePath.c_str(), std::ios_base::binary);
+			if (!inputStream.is_open())
+				return KmerError(1, "Error opening input file " + params.filePath);
+
+			FastqReader reader(inputStream);
+			FastqReader::FastqEntry entry;
+			setupReader(params, reader);
+
+			size_t kmerSizes = params.kmerWidths.size();
+
+			//Declared before the runs, their databases are removed before the directories
+			ScratchSpace scratch(params.tmpDirs);
+			std::vector<std::unique_ptr<KmerSizeRun>> runs;
+
+			for (size_t i = 0; i < kmerSizes; i++) {
+
+				size_t kmerWidth = params.kmerWidths[i];
+
+				ProgramParams kmerSizeParams(params);
+				kmerSizeParams.kmerWidth = kmerWidth;
+				kmerSizeParams.outputLog = perKmerPath(params.outputLog, kmerWidth);
+				kmerSizeParams.histoPath = perKmerPath(params.histoPath, kmerWidth);
+				kmerSizeParams.exportPath = perKmerPath(params.exportPath, kmerWidth);
+
+				CounterSettings settings;
+				settings.memoryBudget = params.memoryBudget / kmerSizes;
+				settings.memoryLimit = params.memoryLimit / kmerSizes;
+				settings.diskLimit = params.diskLimit / kmerSizes;
+				settings.merizeThreads = params.merizeThreads;
+
+				KmerError err = scratch.getPath(i, "kmerCache.k" + std::to_string(kmerWidth), settings.scratchPath);
+				if (err.isError()) return err;
+
+				AddKmerSizeAction action = { kmerSizeParams, settings, runs };
+				err = withCounterType<Precision, InlinePrecision>(counterType, kmerWidth, action);
+				if (err.isError()) return err;
+
+			}
+
+			//Size for the progress percentage and ETA
+			inputStream.seekg(0, std::ios_base::end);
+			size_t inputBytes = inputStream.tellg() > 0 ? (size_t)inputStream.tellg() : 0;
+			inputStream.seekg(0, std::ios_base::beg);
+
+			//Declared after the runs so it stops sampling before they go away
+			ProgressReporter progress(params.outputTerminal, params.progressInterval, inputBytes, params.progressTextfile,
+				[&runs](ProgressReporter::Sample & sample) {
+					sample.flushes = 0;
+					sample.databaseBytes = 0;
+					for (auto & i : runs) {
+						sample.flushes += i->getFlushCount();
+						sample.databaseBytes += i->getDatabaseSize();
+					}
+				});
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			ReadBatchRing ring(16, kmerSizes);
+			std::vector<KmerError> runErrors(kmerSizes);
+			std::vector<std::thread> threads;
+
+			for (size_t i = 0; i < kmerSizes; i++) {
+				threads.emplace_back([&ring, &runs, &runErrors, i]() {
+					while (auto batch = ring.next(i)) {
+						for (auto & read : *batch) {
+							runErrors[i] = runs[i]->add(read.encoded, read.weight);
+							if (runErrors[i].isError()) {
+								ring.leave(i);
+								return;
+							}
+						}
+					}
+				});
+			}
+
+			size_t count = 0;
+			size_t bytes = 0;
+			size_t kmers = 0;
+			KmerError err;
+			std::shared_ptr<ReadBatchRing::Batch> batch(new ReadBatchRing::Batch());
+			batch->reserve(batchReads);
+
+			//Batches in the ring and the one being filled. The ring's figure only changes when a batch
+			//is pushed, so it's only asked then.
+			size_t ringBytes = 0;
+			size_t batchBytes = ReadBatchRing::getBatchBytes(*batch);
+
+			//Encodes a read into the batch and hands full batches to the ring. Once every run has
+			//left there's no one to count for, their errors are reported below.
+			bool allRunsLeft = false;
+			auto queueRead = [&](const std::string & sequence, size_t weight) {
+
+				batch->emplace_back();
+				batch->back().weight = weight;
+				KmerError err = KmerCounter<Precision>::encodeSequence(sequence, batch->back().encoded, params.minQuality != 0);
+				if (err.isError()) return err;
+				batchBytes += batch->back().encoded.capacity();
+
+				if (batch->size() == batchReads) {
+					allRunsLeft = !ring.push(batch);
+					ringBytes = ring.getHeldBytes();
+					batch.reset(new ReadBatchRing::Batch());
+					batch->reserve(batchReads);
+					batchBytes = ReadBatchRing::getBatchBytes(*batch);
+				}
+
+				return KmerError();
+
+			};
+
+			//Collapsed reads are encoded once and go to every k with their multiplicity
+			std::unique_ptr<ReadDeduplicator> dedup;
+			if (params.dedupReads)
+				dedup.reset(new ReadDeduplicator(params.dedupReads, queueRead));
+
+			//This loop reads in from a FASTQ file until its empty
+			while (inputStream.good() && (params.maxReads == 0 || count < params.maxReads)) {
+
+				err = reader.getEntry(entry);
+
+				if (reader.atEnd()) {
+					err = KmerError();
+					break;
+				}
+
+				if (err.isError())
+					break;
+
+				err = dedup ? dedup->add(entry.sequence) : queueRead(entry.sequence, 1);
+				if (err.isError() || allRunsLeft)
+					break;
+
+				count++;
+
+				bytes += reader.getEntryBytes();
+				for (auto k : params.kmerWidths)
+					if (entry.sequence.size() >= k)
+						kmers += entry.sequence.size() - k + 1;
+
+				//The reader is shared, each k is charged its part like it gets its part of the memory limit
+				size_t readerBytes = entry.seqID.capacity() + entry.sequence.capacity() + entry.alignment.capacity() + entry.quality.capacity()
+					+ (dedup ? dedup->getHeldBytes() : 0) + ringBytes + batchBytes;
+				for (auto & i : runs) {
+					err = i->getFootprint().update(Footprint::Reader, readerBytes / kmerSizes);
+					if (err.isError()) break;
+				}
+				if (err.isError()) break;
+
+				progress.reads.store(count, std::memory_order_relaxed);
+				progress.bytes.store(bytes + reader.getSkippedBytes(), std::memory_order_relaxed);
+				progress.kmers.store(kmers, std::memory_order_relaxed);
+			}
+
+			double sampleRate = err.isError() ? 1 : getSampleRate(params, reader, inputStream, inputBytes, count);
+			reportMasking(params, reader);
+
+			if (!err.isError() && !allRunsLeft)
+				err = finishDeduplication(params, dedup.get());
+
+			if (!batch->empty())
+				ring.push(batch);
+			ring.close();
+
+			for (auto & i : threads)
+				i.join();
+
+			if (err.isError()) return err;
+			for (auto & i : runErrors)
+				if (i.isError()) return i;
+
+			double duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+			params.outputTerminal << "Getting mers" << std::endl;
+			progress.setPhase("getting mers");
+
+			for (size_t i = 0; i < kmerSizes; i++) {
+
+				params.outputTerminal << "k=" << params.kmerWidths[i] << std::endl;
+
+				err = runs[i]->finish(progress, count, duration, sampleRate);
+				if (err.isError()) return err;
+
+			}
+
+		}
+		catch (KmerError & e) {
+			return e;
+		}
+
+		return KmerError();
+
+	}
+
+	struct CountMersAction {
+		ProgramParams & params;
+		template <class CounterType> KmerError run() { return countMers<CounterType>(params); };
+	};
+
+	//Entry point once the arguments are parsed
+	template <typename Precision, typename InlinePrecision = Precision> KmerError createProgram(char counterType, ProgramParams & params) {
+
+		if (params.kmerWidths.size() > 1)
+			return countKmerSizes<Precision, InlinePrecision>(counterType, params);
+
+		CountMersAction action = { params };
+		return withCounterType<Precision, InlinePrecision>(counterType, params.kmerWidth, action);
+
+	}
+
 };
@@ -4,8 +4,11 @@
 
 #include "kmerUtils.h"
 #include "kmerCounter.h"
+#include "kmerQuery.h"
+#include "kmerMerge.h"
 #include <algorithm>
 #include <chrono>
+#include <sstream>
 
 using namespace KmerUtils;
 using namespace std;
@@ -19,18 +22,128 @@ int main(int argc, char * argv[]) {
 	KmerError err = getAllArguments(argc, argv, args);
 	if (err.isError()) return displayError(err, params.outputTerminal);
 
+	map<string, string> options;
+	err = getOptions(args, options);
+	if (err.isError()) return displayError(err, params.outputTerminal);
+
+	//kmerCounter query <table> [queries] [--out file]
+	if (args.size() >= 2 && args[1] == "query") {
+
+		QueryParams query(params.outputTerminal);
+
+		if (args.size() != 3 && args.size() != 4) {
+			params.outputTerminal << "Usage: kmerCounter query <table> [queries] [--out <file>]" << endl;
+			params.outputTerminal << "table : count table written with --export, or a database kept with --keep-db" << endl;
+			params.outputTerminal << "queries [optional] : file with one kmer per line. Omitted or - reads stdin" << endl;
+			params.outputTerminal << "--out <file> : write the \"kmer,count\" lines to file instead of the terminal" << endl;
+			return 1;
+		}
+
+		query.tablePath = args[2];
+		if (args.size() == 4)
+			query.queryPath = args[3];
+
+		for (auto & i : options) {
+			if (i.first == "--out")
+				query.outputPath = i.second;
+			else
+				return displayError(KmerError(1, "Unknown option " + i.first), params.outputTerminal);
+		}
+
+		return displayError(runQuery(query), params.outputTerminal);
+
+	}
+
+	//kmerCounter merge <topKmersToReport> <input>... [options]
+	if (args.size() >= 2 && args[1] == "merge") {
+
+		MergeParams merge(params.outputTerminal);
+
+		if (args.size() < 4) {
+			params.outputTerminal << "Usage: kmerCounter merge <topKmersToReport> <input>... [options]" << endl;
+			params.outputTerminal << "input : count table written with --export, or a database kept with --keep-db or --append-to" << endl;
+			params.outputTerminal << "--out <file> : write the top kmers to file instead of the terminal" << endl;
+			params.outputTerminal << "--export <file> : write every merged kmer to a count table" << endl;
+			params.outputTerminal << "--export-index <n> : add a sparse index holding every n-th key of the count table" << endl;
+			params.outputTerminal << "--threads <n> : merge threads, default every core" << endl;
+			params.outputTerminal << "--memory <size> : memory for the hash merge's partitions and the count table's runs. Default 2G" << endl;
+			params.outputTerminal << "--tmp-dir <dir>[,<dir>...] : where the hash merge spills its partitions. Default $TMPDIR or /tmp" << endl;
+			return 1;
+		}
+
+		try {
+
+			merge.topCount = stoul(args[2]);
+			merge.inputPaths.assign(args.begin() + 3, args.end());
+
+			for (auto & i : options) {
+
+				if (i.first == "--out")
+					merge.outputPath = i.second;
+				else if (i.first == "--export")
+					merge.exportPath = i.second;
+				else if (i.first == "--export-index")
+					merge.exportIndexStride = stoul(i.second);
+				else if (i.first == "--threads")
+					merge.threads = stoul(i.second);
+				else if (i.first == "--memory")
+					err = parseByteSize(i.second, merge.memoryBudget);
+				else if (i.first == "--tmp-dir")
+					merge.tmpDirs = ScratchSpace::split(i.second);
+				else
+					err = KmerError(1, "Unknown option " + i.first);
+
+				if (err.isError()) return displayError(err, params.outputTerminal);
+
+			}
+
+		}
+		catch (std::exception & e) {
+			return displayError(e, params.outputTerminal);
+		}
+
+		return displayError(runMerge(merge), params.outputTerminal);
+
+	}
 
 	//Check argument size
 	if (args.size() != 6 && args.size() != 7) {
 
 		params.outputTerminal << "Invalid number of arguments. Usage:" << endl;
-		params.outputTerminal << "kmerCounter <inputFile> <kmerSize> <topKmersToReport> <precision> <counterType> [output]" << endl;
-		params.outputTerminal << "inputFile : FASTQ file to process" << endl;
-		params.outputTerminal << "kmerSize  : Number of base pairs in a mer" << endl;
+		params.outputTerminal << "kmerCounter <inputFile> <kmerSize> <topKmersToReport> <precision> <counterType> [output] [options]" << endl;
+		params.outputTerminal << "kmerCounter query <table> [queries] [--out <file>] : look up kmers in a saved count table or database" << endl;
+		params.outputTerminal << "kmerCounter merge <topKmersToReport> <input>... [options] : combine the counts of saved count tables and databases" << endl;
+		params.outputTerminal << "inputFile : FASTQ or FASTA file to process, records may be wrapped over several lines" << endl;
+		params.outputTerminal << "kmerSize  : Number of base pairs in a mer. A list such as 21,25,31 counts each size in one pass over the input, writing output, --histo and --export files with a .k<size> suffix" << endl;
 		params.outputTerminal << "topKmersToReport : The number of most frequent kmers to report" << endl;
-		params.outputTerminal << "precision : size of accumulators. 0 = 1 byte (max 2^8-1), 1 = 2 bytes (max 2^16-1), 2 = 4 bytes (max 2^32-1), 3 = 8 bytes (max 2^64-1)" << endl;
+		params.outputTerminal << "precision : size of accumulators. 0 = 1 byte (max 2^8-1), 1 = 2 bytes (max 2^16-1), 2 = 4 bytes (max 2^32-1), 3 = 8 bytes (max 2^64-1), 4 = adaptive (1 byte counters that spill into an 8 byte overflow table, max 2^64-1; with counter type 2 the table stores key and 1 byte counter only, the other counters only get a smaller database)" << endl;
 		params.outputTerminal << "counterType: sorting algorithm to use. 0 = Sort and accumulate (fast, worse memory), 1 = Ordered hash Map (slow, good memory, consistent performance), 2 = Unordered hash map (better speed, good memory, delays during rehashing)" << endl;
 		params.outputTerminal << "output [optional] : output file to write top kmers to" << endl;
+		params.outputTerminal << endl;
+		params.outputTerminal << "Options:" << endl;
+		params.outputTerminal << "--memory <size> : memory budget for counter tables and database cache, e.g. 512M, 28G or 90% of physical RAM. Tables are flushed to the database based on their actual footprint" << endl;
+		params.outputTerminal << "--min-count <n> : only report kmers seen at least n times. Kmers first seen in the last flush with fewer are never written to the database" << endl;
+		params.outputTerminal << "--histo <file> : write the kmer abundance histogram (\"count kmers\" lines) computed during the final pass" << endl;
+		params.outputTerminal << "--histo-max <n> : counts of n and above share the histogram's last bin. Default 10000" << endl;
+		params.outputTerminal << "--export <file> : write every kmer and its count to a sorted binary count table (see countTable.h)" << endl;
+		params.outputTerminal << "--export-index <n> : add a sparse index holding every n-th key of the count table" << endl;
+		params.outputTerminal << "--keep-db <file> : count into the database file and keep it afterwards, for the query subcommand" << endl;
+		params.outputTerminal << "--append-to <file> : add this input's counts to a database kept by earlier runs (created if missing). k and precision must match" << endl;
+		params.outputTerminal << "--memory-limit <size> : fail with an error naming the subsystem (tables, flush tables, top cache, database map, reader) once the tracked memory would exceed size. Sets the memory budget to 90% of it unless --memory is given" << endl;
+		params.outputTerminal << "--disk-limit <size> : fail once the database file would grow past size" << endl;
+		params.outputTerminal << "--progress-interval <seconds> : print a status line (reads, MB/s, ETA, flushes, RSS, database size) every interval, 0 disables it. Default 5" << endl;
+		params.outputTerminal << "--tmp-dir <dir>[,<dir>...] : where the scratch database goes, in a private directory created for the run. Default $TMPDIR or /tmp. Several directories stripe the --workers databases over them" << endl;
+		params.outputTerminal << "--checkpoint <file> : every checkpoint interval, flush and commit the database and record the input offset reached in file" << endl;
+		params.outputTerminal << "--resume <file> : like --checkpoint, but first continue from the checkpoint in file if there is one. Input, k, precision, --min-qual, --sample-fraction, --max-reads and --dedup must match" << endl;
+		params.outputTerminal << "--checkpoint-interval <seconds> : time between checkpoints. Default 600" << endl;
+		params.outputTerminal << "--sample-fraction <f> : count only the reads whose ID hashes into fraction f of the hash range (reproducible). Counts are scaled back and written as kmer,estimate,low,high with a 95% confidence interval" << endl;
+		params.outputTerminal << "--max-reads <n> : stop after counting n reads, scaling the counts by the share of the input scanned" << endl;
+		params.outputTerminal << "--dedup <n> : collapse exact duplicate reads, holding up to n distinct ones. Each is counted once with its multiplicity" << endl;
+		params.outputTerminal << "--min-qual <q> : treat bases with a Phred+33 quality below q as breaks, no kmer covering one is counted" << endl;
+		params.outputTerminal << "--merize-threads <n> : merize the segments of long reads (over 65536 kmers) on n threads while they're counted. Default 1" << endl;
+		params.outputTerminal << "--workers <n> : count in n processes, each owning a partition of the kmers (by minimizer) and its own database. Each read is cut into runs of kmers that are sent to the worker owning them. Their top kmers are merged" << endl;
+		params.outputTerminal << "--progress-textfile <file> : rewrite Prometheus style progress metrics into file every interval, for node_exporter's textfile collector" << endl;
+		params.outputTerminal << "--stats-json <file> : write per stage timings (parse, encode, merize, count, flush, topScan), throughput and flush/top cache counters as JSON" << endl;
 
 		params.outputTerminal << endl;
 
@@ -45,10 +158,25 @@ int main(int argc, char * argv[]) {
 	try {
 
 		params.filePath = args[1];
-		params.kmerWidth = stoul(args[2]);
 
-		if(params.kmerWidth == 0)
-			return displayError(KmerError(1, "Invalid kmer width :" + to_string(params.kmerWidth)), params.outputTerminal);
+		//21,25,31 counts several kmer sizes in one pass
+		istringstream widths(args[2]);
+		string width;
+		while (getline(widths, width, ',')) {
+
+			size_t kmerWidth = stoul(width);
+
+			if (kmerWidth == 0 || find(params.kmerWidths.begin(), params.kmerWidths.end(), kmerWidth) != params.kmerWidths.end())
+				return displayError(KmerError(1, "Invalid kmer width :" + width), params.outputTerminal);
+
+			params.kmerWidths.push_back(kmerWidth);
+
+		}
+
+		if (params.kmerWidths.empty())
+			return displayError(KmerError(1, "Invalid kmer width :" + args[2]), params.outputTerminal);
+
+		params.kmerWidth = params.kmerWidths[0];
 
 
 		params.topCount = stoul(args[3]);
@@ -58,10 +186,109 @@ int main(int argc, char * argv[]) {
 
 		precision = stoul(args[4]);
 		counterType = stoul(args[5]);
-		params.threshold = 0; //deprecated
 		if (args.size() == 7)
 			params.outputLog = args[6];
 
+		for (auto & i : options) {
+
+			if (i.first == "--memory")
+				err = parseByteSize(i.second, params.memoryBudget);
+			else if (i.first == "--min-count")
+				params.threshold = stoul(i.second);
+			else if (i.first == "--histo")
+				params.histoPath = i.second;
+			else if (i.first == "--histo-max") {
+				params.histoMax = stoul(i.second);
+				if (params.histoMax < 2)
+					err = KmerError(1, "Invalid histogram size : " + i.second);
+			}
+			else if (i.first == "--export")
+				params.exportPath = i.second;
+			else if (i.first == "--export-index")
+				params.exportIndexStride = stoul(i.second);
+			else if (i.first == "--keep-db" || i.first == "--append-to") {
+				if (params.keepDatabasePath.size() != 0)
+					err = KmerError(1, "--keep-db and --append-to can't be combined");
+				params.keepDatabasePath = i.second;
+				params.appendDatabase = i.first == "--append-to";
+			}
+			else if (i.first == "--memory-limit")
+				err = parseByteSize(i.second, params.memoryLimit);
+			else if (i.first == "--disk-limit")
+				err = parseByteSize(i.second, params.diskLimit);
+			else if (i.first == "--progress-interval") {
+				params.progressInterval = stod(i.second);
+				if (params.progressInterval < 0)
+					err = KmerError(1, "Invalid progress interval : " + i.second);
+			}
+			else if (i.first == "--progress-textfile")
+				params.progressTextfile = i.second;
+			else if (i.first == "--tmp-dir") {
+				params.tmpDirs = ScratchSpace::split(i.second);
+				if (params.tmpDirs.empty())
+					err = KmerError(1, "Invalid scratch directory list : " + i.second);
+			}
+			else if (i.first == "--checkpoint" || i.first == "--resume") {
+				if (params.checkpointPath.size() != 0)
+					err = KmerError(1, "--checkpoint and --resume can't be combined");
+				params.checkpointPath = i.second;
+				params.resume = i.first == "--resume";
+			}
+			else if (i.first == "--checkpoint-interval") {
+				params.checkpointInterval = stod(i.second);
+				if (params.checkpointInterval < 0)
+					err = KmerError(1, "Invalid checkpoint interval : " + i.second);
+			}
+			else if (i.first == "--sample-fraction") {
+				params.sampleFraction = stod(i.second);
+				if (params.sampleFraction <= 0 || params.sampleFraction > 1)
+					err = KmerError(1, "Invalid sample fraction : " + i.second);
+			}
+			else if (i.first == "--max-reads") {
+				params.maxReads = stoull(i.second);
+				if (params.maxReads == 0)
+					err = KmerError(1, "Invalid read limit : " + i.second);
+			}
+			else if (i.first == "--dedup") {
+				params.dedupReads = stoull(i.second);
+				if (params.dedupReads == 0)
+					err = KmerError(1, "Invalid number of reads to deduplicate : " + i.second);
+			}
+			else if (i.first == "--min-qual") {
+				params.minQuality = stoul(i.second);
+				if (params.minQuality == 0 || params.minQuality > 93)
+					err = KmerError(1, "Invalid minimum quality : " + i.second);
+			}
+			else if (i.first == "--merize-threads") {
+				params.merizeThreads = stoul(i.second);
+				if (params.merizeThreads == 0)
+					err = KmerError(1, "Invalid number of merize threads : " + i.second);
+			}
+			else if (i.first == "--workers") {
+				params.workers = stoul(i.second);
+				if (params.workers == 0)
+					err = KmerError(1, "Invalid number of workers : " + i.second);
+			}
+			else if (i.first == "--stats-json") {
+				params.statsPath = i.second;
+				if (!KmerStats::isEnabled())
+					err = KmerError(1, "--stats-json needs a build with -DKMER_STATS=ON");
+			}
+			else
+				err = KmerError(1, "Unknown option " + i.first);
+
+			if (err.isError()) return displayError(err, params.outputTerminal);
+
+		}
+
+		//Workers only send back their top kmers, everything needing all of them stays single process for now
+		if (params.workers > 1 && (params.histoPath.size() || params.exportPath.size() || params.keepDatabasePath.size() || params.statsPath.size() || params.checkpointPath.size()))
+			return displayError(KmerError(1, "--workers can't be combined with --histo, --export, --keep-db, --append-to, --stats-json, --checkpoint or --resume"), params.outputTerminal);
+
+		//Each kmer size has its own database, the single database and the per stage timings don't split up
+		if (params.kmerWidths.size() > 1 && (params.workers > 1 || params.keepDatabasePath.size() || params.statsPath.size() || params.checkpointPath.size()))
+			return displayError(KmerError(1, "Several kmer sizes can't be combined with --workers, --keep-db, --append-to, --stats-json, --checkpoint or --resume"), params.outputTerminal);
+
 	}
 	catch (std::exception & e) {
 		return displayError(e, params.outputTerminal);
@@ -81,6 +308,9 @@ int main(int argc, char * argv[]) {
 	case 3:
 		err = createProgram<size_t>(counterType, params);
 		break;
+	case 4:
+		err = createProgram<size_t, unsigned char>(counterType, params);
+		break;
 	default:
 		return displayError(KmerError(1, "Invalid precision"), params.outputTerminal);
 	}
@@ -10,13 +10,21 @@ template<> vector<vector<char>> Merizer<vector<char>>::getMerTokens(vector<char>
 		return rtn;
 
 	size_t totalKmers = sequence.size() - kmerWidth + 1;
-	 rtn.resize(totalKmers);
+	rtn.reserve(totalKmers);
 
 	auto begin = sequence.begin();
 
-	for (auto i = 0; i < totalKmers; i++) {
+	//Only windows of kmerWidth unmasked bases are kmers
+	size_t run = 0;
+	for (size_t i = 0; i < sequence.size(); i++) {
 
-		rtn[i] = vector<char>(begin + i, begin + i + kmerWidth);
+		if (sequence[i] == maskedBaseCode) {
+			run = 0;
+			continue;
+		}
+
+		if (++run >= kmerWidth)
+			rtn.push_back(vector<char>(begin + i + 1 - kmerWidth, begin + i + 1));
 
 	}
 
@@ -5,6 +5,11 @@
 #include <bitset>
 #include <array>
 
+//Bases the reader masked out (FastqReader::setMinQuality) are written as maskedBase and encoded as
+//maskedBaseCode. They break the sequence: no kmer token covers one.
+const char maskedBase = '.';
+const char maskedBaseCode = 5;
+
 //Base Merizer template. Specialized from this to implement functions, kind of like an interface.
 //The Merizer is intended to separate the process of calculating mers from how mers are managed in hash tables or other algorithms,
 //so the two can be interchanged without having a lot of duplicate code. 
@@ -80,18 +85,20 @@ public:
 			return rtn;
 
 		size_t totalKmers = sequence.size() - kmerWidth + 1;
-		 rtn.resize(totalKmers);
+		rtn.reserve(totalKmers);
 
 		std::bitset<N> tokenizer; tokenizer.reset();
 
-		//Need to prime tokenizer
-		for (auto i = 0; i < kmerWidth-1; i++)
-			pushBasePairToTokenizer(tokenizer, sequence[i]);
-
-		//Now start collecting tokens;
-		for (auto i = 0; i < totalKmers; i++) {
-			pushBasePairToTokenizer(tokenizer, sequence[i+kmerWidth-1]);
-			rtn[i] = tokenizer;
+		//The tokenizer holds a kmer once kmerWidth unmasked bases have been pushed since the last masked one
+		size_t run = 0;
+		for (auto base : sequence) {
+			if (base == maskedBaseCode) {
+				run = 0;
+				continue;
+			}
+			pushBasePairToTokenizer(tokenizer, base);
+			if (++run >= kmerWidth)
+				rtn.push_back(tokenizer);
 		}
 
 		return rtn;
@@ -107,7 +114,7 @@ public:
 
 			auto thisElement = kmerWidth - 1 - i;
 			auto thisChar = token & firstBasePairMask;
-			rtn[thisElement] = thisChar;// getCharacterFromValue(thisChar);
+			rtn[thisElement] = (char)thisChar.to_ulong();// getCharacterFromValue(thisChar);
 			token >>= bitsPerBasePair;
 
 		}
@@ -119,7 +126,7 @@ public:
 private:
 
 	void pushBasePairToTokenizer(std::bitset<N> & tokenizer, char val) {
-		tokenizer = ((tokenizer << bitsPerBasePair) & mask) | val;// getValueFromCharacter(val);
+		tokenizer = ((tokenizer << bitsPerBasePair) & mask) | std::bitset<N>((unsigned char)val);// getValueFromCharacter(val);
 	}
 
 	size_t bitsNeeded;
@@ -172,7 +179,7 @@ public:
 		fullRegisterMaskShift = bitsPerSizeT - bitsPerBasePair;
 
 		remainderBits = bitsNeeded - (usedRegisters - 1) * bitsPerSizeT;// bitsNeeded % bitsPerSizeT;
-		lastRegisterMask = (1 << remainderBits) - 1;
+		lastRegisterMask = remainderBits >= bitsPerSizeT ? ~(T)0 : ((T)1 << remainderBits) - 1;
 
 
 	};
@@ -188,20 +195,22 @@ public:
 			return rtn;
 
 		size_t totalKmers = sequence.size() - kmerWidth + 1;
-		rtn.resize(totalKmers);
+		rtn.reserve(totalKmers);
 
 		std::array<T, N> tokenizer;
 		for (auto & i : tokenizer)
 			i = 0;
 
-		//Need to prime tokenizer
-		for (auto i = 0; i < kmerWidth - 1; i++)
-			pushBasePairToTokenizer(tokenizer, sequence[i]);
-
-		//Now start collecting tokens;
-		for (auto i = 0; i < totalKmers; i++) {
-			pushBasePairToTokenizer(tokenizer, sequence[i + kmerWidth - 1]);
-			rtn[i] = tokenizer;
+		//The tokenizer holds a kmer once kmerWidth unmasked bases have been pushed since the last masked one
+		size_t run = 0;
+		for (auto base : sequence) {
+			if (base == maskedBaseCode) {
+				run = 0;
+				continue;
+			}
+			pushBasePairToTokenizer(tokenizer, base);
+			if (++run >= kmerWidth)
+				rtn.push_back(tokenizer);
 		}
 
 		return rtn;
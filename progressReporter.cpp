@@ -0,0 +1,154 @@
+#include "progressReporter.h"
+#include "kmerUtils.h"
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <cstdio>
+
+using namespace std;
+
+ProgressReporter::ProgressReporter(std::ostream & _out, double _interval, size_t _totalBytes, std::string _textfilePath, Sampler _sampler)
+	:bytes(0), reads(0), kmers(0), out(_out), interval(_interval), totalBytes(_totalBytes), textfilePath(_textfilePath), sampler(_sampler),
+	phase("counting"), start(chrono::steady_clock::now()), lastReport(start), lastBytes(0), lastKmers(0), stopping(false) {
+
+	//Nothing to do, don't bother starting the thread
+	if (interval > 0 || textfilePath.size() != 0)
+		worker = thread(&ProgressReporter::run, this);
+
+}
+
+void ProgressReporter::setPhase(const char * _phase) {
+	phase.store(_phase, memory_order_relaxed);
+}
+
+void ProgressReporter::run() {
+
+	//textfile only runs still need a tick
+	auto tick = chrono::duration<double>(interval > 0 ? interval : 5.0);
+
+	unique_lock<std::mutex> lock(mutex);
+
+	while (!wake.wait_for(lock, tick, [this] { return stopping; })) {
+		lock.unlock();
+		report(false);
+		lock.lock();
+	}
+
+}
+
+void ProgressReporter::report(bool final) {
+
+	Sample sample;
+	if (sampler) sampler(sample);
+
+	size_t rss = KmerUtils::getResidentBytes();
+	const char * thisPhase = final ? "done" : phase.load(memory_order_relaxed);
+
+	if (textfilePath.size() != 0) {
+		//A failed write shouldn't take the run down, the next tick will try again
+		writeTextfile(sample, rss, thisPhase);
+	}
+
+	if (interval <= 0 || final)
+		return;
+
+	auto now = chrono::steady_clock::now();
+	double elapsed = chrono::duration<double>(now - start).count();
+	double sinceLast = chrono::duration<double>(now - lastReport).count();
+	size_t readBytes = bytes.load(memory_order_relaxed);
+	size_t readKmers = kmers.load(memory_order_relaxed);
+
+	//ETA from the average rate, the rates shown are over the last interval
+	double averageRate = elapsed > 0 ? readBytes / elapsed : 0;
+	double byteRate = sinceLast > 0 ? (readBytes - lastBytes) / sinceLast : 0;
+	double kmerRate = sinceLast > 0 ? (readKmers - lastKmers) / sinceLast : 0;
+
+	lastReport = now;
+	lastBytes = readBytes;
+	lastKmers = readKmers;
+
+	//Build the whole line first so it can't interleave with output from the counting thread
+	ostringstream line;
+	line << fixed << setprecision(1) << "[" << thisPhase << "] " << reads.load(memory_order_relaxed) << " reads, "
+		<< readBytes / (1024.0 * 1024.0) << " MB";
+
+	if (totalBytes != 0) {
+		line << " of " << totalBytes / (1024.0 * 1024.0) << " MB (" << 100.0 * readBytes / totalBytes << "%)";
+		if (averageRate > 0 && readBytes < totalBytes)
+			line << ", ETA " << (totalBytes - readBytes) / averageRate << " s";
+	}
+
+	line << ", " << byteRate / (1024.0 * 1024.0) << " MB/s, " << kmerRate << " kmers/s"
+		<< ", flushes " << sample.flushes << ", RSS " << rss / (1024.0 * 1024.0) << " MB, DB " << sample.databaseBytes / (1024.0 * 1024.0) << " MB\n";
+
+	out << line.str() << flush;
+
+}
+
+KmerError ProgressReporter::writeTextfile(Sample & sample, size_t rss, const char * thisPhase) {
+
+	//Write next to the target and rename, so a collector never reads a half written file
+	string tempPath = textfilePath + ".tmp";
+
+	ofstream file(tempPath.c_str());
+	if (file.fail())
+		return KmerError(1, "Error opening progress textfile " + tempPath);
+
+	file << "# HELP kmercounter_input_bytes Size of the input file in bytes." << endl;
+	file << "# TYPE kmercounter_input_bytes gauge" << endl;
+	file << "kmercounter_input_bytes " << totalBytes << endl;
+	file << "# HELP kmercounter_read_bytes_total Input bytes consumed." << endl;
+	file << "# TYPE kmercounter_read_bytes_total counter" << endl;
+	file << "kmercounter_read_bytes_total " << bytes.load(memory_order_relaxed) << endl;
+	file << "# HELP kmercounter_reads_total FASTQ records processed." << endl;
+	file << "# TYPE kmercounter_reads_total counter" << endl;
+	file << "kmercounter_reads_total " << reads.load(memory_order_relaxed) << endl;
+	file << "# HELP kmercounter_kmers_total Kmer positions processed." << endl;
+	file << "# TYPE kmercounter_kmers_total counter" << endl;
+	file << "kmercounter_kmers_total " << kmers.load(memory_order_relaxed) << endl;
+	file << "# HELP kmercounter_flushes_total Counter tables flushed to the database." << endl;
+	file << "# TYPE kmercounter_flushes_total counter" << endl;
+	file << "kmercounter_flushes_total " << sample.flushes << endl;
+	file << "# HELP kmercounter_resident_bytes Resident set size of the process." << endl;
+	file << "# TYPE kmercounter_resident_bytes gauge" << endl;
+	file << "kmercounter_resident_bytes " << rss << endl;
+	file << "# HELP kmercounter_database_bytes Size of the kmer database file." << endl;
+	file << "# TYPE kmercounter_database_bytes gauge" << endl;
+	file << "kmercounter_database_bytes " << sample.databaseBytes << endl;
+	file << "# HELP kmercounter_elapsed_seconds Time since counting started." << endl;
+	file << "# TYPE kmercounter_elapsed_seconds gauge" << endl;
+	file << "kmercounter_elapsed_seconds " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << endl;
+	file << "# HELP kmercounter_phase Current phase of the run." << endl;
+	file << "# TYPE kmercounter_phase gauge" << endl;
+	file << "kmercounter_phase{phase=\"" << thisPhase << "\"} 1" << endl;
+
+	file.close();
+	if (file.fail())
+		return KmerError(1, "Error writing progress textfile " + tempPath);
+
+	if (rename(tempPath.c_str(), textfilePath.c_str()) != 0)
+		return KmerError(1, "Error renaming progress textfile to " + textfilePath);
+
+	return KmerError();
+
+}
+
+void ProgressReporter::stop() {
+
+	if (!worker.joinable())
+		return;
+
+	unique_lock<std::mutex> lock(mutex);
+	stopping = true;
+	lock.unlock();
+
+	wake.notify_one();
+	worker.join();
+
+	report(true);
+
+}
+
+ProgressReporter::~ProgressReporter() {
+	stop();
+}
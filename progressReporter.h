@@ -0,0 +1,71 @@
+#pragma once
+
+#include "kmerError.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <chrono>
+
+//Status thread for long runs. The ingest loop only stores into the relaxed atomics below, the
+//reporter wakes up every interval, samples them together with the figures that live elsewhere
+//(flushes, database size, RSS) and prints one status line and/or rewrites a Prometheus textfile.
+//Nothing on the hot path flushes a stream or takes a lock.
+class ProgressReporter {
+
+public:
+
+	//Figures owned by other components, filled in on the reporter thread
+	struct Sample {
+		Sample() :flushes(0), databaseBytes(0) {};
+		size_t flushes;
+		size_t databaseBytes;
+	};
+
+	typedef std::function<void(Sample &)> Sampler;
+
+	//interval <= 0 disables the status line. textfilePath is rewritten (through a rename) every interval when set.
+	ProgressReporter(std::ostream & out, double interval, size_t totalBytes, std::string textfilePath, Sampler sampler);
+
+	//Phase shown in the status line, e.g. "counting" or "getting mers". Must point to a string literal.
+	void setPhase(const char * phase);
+
+	//Stops the thread after a final textfile update. Called by the destructor too.
+	void stop();
+
+	~ProgressReporter();
+
+	std::atomic<size_t> bytes;
+	std::atomic<size_t> reads;
+	std::atomic<size_t> kmers;
+
+private:
+
+	void run();
+	void report(bool final);
+	KmerError writeTextfile(Sample & sample, size_t rss, const char * phase);
+
+	std::ostream & out;
+	double interval;
+	size_t totalBytes;
+	std::string textfilePath;
+	Sampler sampler;
+
+	std::atomic<const char *> phase;
+	std::chrono::steady_clock::time_point start;
+
+	//previous sample, for rates over the last interval. Only touched by the reporter thread.
+	std::chrono::steady_clock::time_point lastReport;
+	size_t lastBytes;
+	size_t lastKmers;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+
+	std::thread worker; //declared last so everything above is initialized before the thread starts
+
+};
@@ -0,0 +1,88 @@
+#include "readBatchRing.h"
+#include <algorithm>
+
+using namespace std;
+
+ReadBatchRing::ReadBatchRing(size_t capacity, size_t consumers) :slots(capacity), slotBytes(capacity, 0), heldBytes(0), pushed(0), positions(consumers, 0), active(consumers, true), closed(false) {
+}
+
+bool ReadBatchRing::push(shared_ptr<const Batch> batch) {
+
+	size_t bytes = getBatchBytes(*batch);
+
+	unique_lock<std::mutex> lock(mutex);
+
+	//the slowest consumer still reading decides whether the oldest slot can be reused
+	auto slowest = [this]() {
+		size_t position = pushed;
+		for (size_t i = 0; i < positions.size(); i++)
+			if (active[i])
+				position = min(position, positions[i]);
+		return position;
+	};
+
+	changed.wait(lock, [&]() { return pushed - slowest() < slots.size(); });
+
+	if (find(active.begin(), active.end(), true) == active.end())
+		return false;
+
+	size_t slot = pushed % slots.size();
+	heldBytes += bytes - slotBytes[slot];
+	slots[slot] = batch;
+	slotBytes[slot] = bytes;
+	pushed++;
+	changed.notify_all();
+
+	return true;
+
+}
+
+void ReadBatchRing::close() {
+
+	lock_guard<std::mutex> lock(mutex);
+	closed = true;
+	changed.notify_all();
+
+}
+
+shared_ptr<const ReadBatchRing::Batch> ReadBatchRing::next(size_t consumer) {
+
+	unique_lock<std::mutex> lock(mutex);
+
+	changed.wait(lock, [&]() { return positions[consumer] < pushed || closed; });
+
+	if (positions[consumer] == pushed)
+		return nullptr;
+
+	auto batch = slots[positions[consumer] % slots.size()];
+	positions[consumer]++;
+	changed.notify_all();
+
+	return batch;
+
+}
+
+void ReadBatchRing::leave(size_t consumer) {
+
+	lock_guard<std::mutex> lock(mutex);
+	active[consumer] = false;
+	changed.notify_all();
+
+}
+
+size_t ReadBatchRing::getHeldBytes() {
+
+	lock_guard<std::mutex> lock(mutex);
+	return heldBytes;
+
+}
+
+size_t ReadBatchRing::getBatchBytes(const Batch & batch) {
+
+	size_t bytes = batch.capacity() * sizeof(Read);
+	for (auto & read : batch)
+		bytes += read.encoded.capacity();
+
+	return bytes;
+
+}
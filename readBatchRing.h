@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+//Hands batches of encoded reads from the parsing thread to several counting threads, each of which sees
+//every batch in order (one per k with several kmer sizes). The ring holds a fixed number of batches, so
+//the parser blocks once the slowest consumer is that far behind instead of buffering the whole input.
+class ReadBatchRing {
+
+public:
+
+	//An encoded read and the number of times it was seen (see ReadDeduplicator)
+	struct Read {
+		std::vector<char> encoded;
+		size_t weight;
+	};
+
+	typedef std::vector<Read> Batch;
+
+	ReadBatchRing(size_t capacity, size_t consumers);
+
+	//Blocks while the ring is full. False once every consumer has left, the batch is dropped then.
+	bool push(std::shared_ptr<const Batch> batch);
+
+	//No more batches, consumers get nullptr once they have the rest
+	void close();
+
+	//The consumer's next batch, nullptr at the end
+	std::shared_ptr<const Batch> next(size_t consumer);
+
+	//The consumer stops reading (after an error) and no longer holds the producer back
+	void leave(size_t consumer);
+
+	//Memory held by the batches in the ring, see getBatchBytes
+	size_t getHeldBytes();
+
+	//The batch's read array and encoded reads
+	static size_t getBatchBytes(const Batch & batch);
+
+private:
+
+	std::mutex mutex;
+	std::condition_variable changed;
+
+	std::vector<std::shared_ptr<const Batch>> slots;
+	std::vector<size_t> slotBytes;
+	size_t heldBytes;
+	size_t pushed;
+	std::vector<size_t> positions; //batches each consumer has taken
+	std::vector<bool> active;
+	bool closed;
+
+};
@@ -0,0 +1,115 @@
+#include "readDeduplicator.h"
+#include <cstring>
+
+using namespace std;
+
+ReadDeduplicator::ReadDeduplicator(size_t _capacity, Sink _sink) :capacity(_capacity), sink(_sink), reads(0), passedOn(0), heldBytes(0) {
+
+	if (capacity == 0)
+		throw KmerError(1, "Deduplication needs room for at least one read");
+
+	index.reserve(capacity);
+
+}
+
+KmerError ReadDeduplicator::add(const string & sequence) {
+
+	reads++;
+
+	Fingerprint fingerprint = getFingerprint(sequence);
+
+	auto found = index.find(fingerprint);
+	if (found != index.end()) {
+
+		auto entry = found->second;
+
+		//The fingerprint only finds the read, the sequence decides. A collision passes the held read on.
+		if (entry->sequence == sequence) {
+			entry->weight++;
+			entries.splice(entries.begin(), entries, entry);
+			return KmerError();
+		}
+
+		KmerError err = evict(entry);
+		if (err.isError()) return err;
+
+	}
+	else if (entries.size() == capacity) {
+
+		KmerError err = evict(prev(entries.end()));
+		if (err.isError()) return err;
+
+	}
+
+	entries.push_front(Entry{ fingerprint, sequence, 1 });
+	index[fingerprint] = entries.begin();
+	heldBytes += sequence.capacity();
+
+	return KmerError();
+
+}
+
+KmerError ReadDeduplicator::drain() {
+
+	//Oldest first, the order they'd have been evicted in
+	while (!entries.empty()) {
+		KmerError err = evict(prev(entries.end()));
+		if (err.isError()) return err;
+	}
+
+	return KmerError();
+
+}
+
+KmerError ReadDeduplicator::evict(Entries::iterator entry) {
+
+	KmerError err = sink(entry->sequence, entry->weight);
+	passedOn++;
+
+	heldBytes -= entry->sequence.capacity();
+	index.erase(entry->fingerprint);
+	entries.erase(entry);
+
+	return err;
+
+}
+
+//Two 64 bit lanes over the sequence eight bytes at a time, each finished with the murmur3 finalizer
+//and mixed with the other
+ReadDeduplicator::Fingerprint ReadDeduplicator::getFingerprint(const string & sequence) {
+
+	uint64_t a = 14695981039346656037ull ^ sequence.size();
+	uint64_t b = 0x9e3779b97f4a7c15ull;
+
+	auto mix = [&a, &b](uint64_t word) {
+		a = (a ^ word) * 1099511628211ull;
+		a ^= a >> 29;
+		b = (b + word) * 0xc2b2ae3d27d4eb4full;
+		b ^= b >> 32;
+	};
+
+	size_t i = 0;
+	for (; i + 8 <= sequence.size(); i += 8) {
+		uint64_t word;
+		memcpy(&word, sequence.data() + i, 8);
+		mix(word);
+	}
+
+	if (i < sequence.size()) {
+		uint64_t word = 0;
+		memcpy(&word, sequence.data() + i, sequence.size() - i);
+		mix(word);
+	}
+
+	auto finalize = [](uint64_t hash) {
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ull;
+		hash ^= hash >> 33;
+		return hash;
+	};
+
+	return Fingerprint{ finalize(a ^ (b << 17 | b >> 47)), finalize(b + a) };
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "kmerError.h"
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+
+//Collapses exact duplicate reads (--dedup) before they're encoded and merized. Distinct reads are held,
+//keyed by a 128 bit fingerprint of the sequence, in a table of bounded size; a repeat only bumps its
+//multiplicity. When the table is full the least recently seen read is evicted and handed to the sink once,
+//with its multiplicity as weight, so the counts are exactly those of counting every copy. A read evicted
+//and then seen again is simply held anew.
+class ReadDeduplicator {
+
+public:
+
+	typedef std::function<KmerError(const std::string & sequence, size_t weight)> Sink;
+
+	ReadDeduplicator(size_t capacity, Sink sink);
+
+	KmerError add(const std::string & sequence);
+
+	//Hands every held read to the sink, before the final counts or a checkpoint
+	KmerError drain();
+
+	size_t getReads() { return reads; };
+	size_t getPassedOn() { return passedOn; };
+
+	//Sequence bytes held in the table
+	size_t getHeldBytes() { return heldBytes; };
+
+private:
+
+	struct Fingerprint {
+		uint64_t high;
+		uint64_t low;
+		bool operator==(const Fingerprint & other) const { return high == other.high && low == other.low; };
+	};
+
+	struct FingerprintHash {
+		size_t operator()(const Fingerprint & fingerprint) const { return (size_t)fingerprint.low; };
+	};
+
+	struct Entry {
+		Fingerprint fingerprint;
+		std::string sequence;
+		size_t weight;
+	};
+
+	typedef std::list<Entry> Entries;
+
+	static Fingerprint getFingerprint(const std::string & sequence);
+
+	KmerError evict(Entries::iterator entry);
+
+	size_t capacity;
+	Sink sink;
+	Entries entries; //most recently seen first
+	std::unordered_map<Fingerprint, Entries::iterator, FingerprintHash> index;
+	size_t reads;
+	size_t passedOn;
+	size_t heldBytes;
+
+};
@@ -0,0 +1,112 @@
+#include "readRouter.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+	//3 bit codes as KmerCounter::encodeSequence has them, -1 for anything that isn't a base
+	struct BaseCodes {
+		int8_t codes[256];
+		BaseCodes() {
+			fill(begin(codes), end(codes), -1);
+			const char * bases = "GTCAN";
+			for (int8_t i = 0; bases[i]; i++)
+				codes[(unsigned char)bases[i]] = codes[(unsigned char)(bases[i] - 'A' + 'a')] = i;
+		}
+	};
+
+	const BaseCodes baseCodes;
+
+	int code(char base) {
+		return baseCodes.codes[(unsigned char)base];
+	}
+
+	//splitmix64's finalizer, so neighbouring substrings get unrelated hashes
+	uint64_t mix(uint64_t value) {
+		value ^= value >> 30;
+		value *= 0xbf58476d1ce4e5b9ull;
+		value ^= value >> 27;
+		value *= 0x94d049bb133111ebull;
+		return value ^ (value >> 31);
+	}
+
+}
+
+//Shorter minimizers give longer runs, longer ones spread the kmers more evenly. Half of k, but packed in
+//at most 33 bits.
+ReadRouter::ReadRouter(size_t _kmerWidth, size_t _workers) :kmerWidth(_kmerWidth), workers(_workers) {
+
+	minimizerWidth = min<size_t>(max<size_t>(kmerWidth / 2, 1), 11);
+
+}
+
+KmerError ReadRouter::route(const string & sequence, Send send) {
+
+	size_t start = 0;
+
+	while (start < sequence.size()) {
+
+		size_t end = start;
+		while (end < sequence.size() && code(sequence[end]) >= 0)
+			end++;
+
+		if (end - start >= kmerWidth) {
+			KmerError err = routeStretch(sequence.data() + start, end - start, send);
+			if (err.isError()) return err;
+		}
+
+		start = end + 1;
+
+	}
+
+	return KmerError();
+
+}
+
+KmerError ReadRouter::routeStretch(const char * bases, size_t length, Send & send) {
+
+	uint64_t mask = ((uint64_t)1 << (3 * minimizerWidth)) - 1;
+	uint64_t value = 0;
+
+	hashes.resize(length - minimizerWidth + 1);
+	for (size_t i = 0; i < length; i++) {
+		value = ((value << 3) | code(bases[i])) & mask;
+		if (i + 1 >= minimizerWidth)
+			hashes[i + 1 - minimizerWidth] = mix(value);
+	}
+
+	//Sliding minimum over the kmerWidth - minimizerWidth + 1 substrings of each kmer
+	size_t window = kmerWidth - minimizerWidth + 1;
+	size_t runStart = 0, runOwner = 0;
+	minima.clear();
+
+	for (size_t p = 0; p < hashes.size(); p++) {
+
+		while (!minima.empty() && hashes[minima.back()] >= hashes[p])
+			minima.pop_back();
+		minima.push_back(p);
+
+		if (p + 1 < window)
+			continue;
+
+		size_t kmer = p + 1 - window;
+		if (minima.front() < kmer)
+			minima.pop_front();
+
+		size_t owner = hashes[minima.front()] % workers;
+
+		if (kmer == 0)
+			runOwner = owner;
+		else if (owner != runOwner) {
+			KmerError err = send(runOwner, bases + runStart, kmer - runStart + kmerWidth - 1);
+			if (err.isError()) return err;
+			runStart = kmer;
+			runOwner = owner;
+		}
+
+	}
+
+	return send(runOwner, bases + runStart, length - runStart);
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "kmerError.h"
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//Splits reads between --workers processes by kmer. A kmer belongs to the worker its minimizer hashes
+//to: of the kmer's minimizerWidth long substrings, the one with the smallest hash. Neighbouring kmers
+//mostly share their minimizer, so a read comes apart into a few runs of consecutive kmers with the same
+//owner, and each run is sent to its owner as the bases covering it. Every kmer is counted by exactly one
+//worker, always the same one, and a worker only merizes its own kmers plus k-1 bases per run.
+class ReadRouter {
+
+public:
+
+	typedef std::function<KmerError(size_t worker, const char * bases, size_t length)> Send;
+
+	ReadRouter(size_t kmerWidth, size_t workers);
+
+	//Calls send for every run of sequence in read order. Masked bases break the read like they do in the
+	//counters: no run covers one.
+	KmerError route(const std::string & sequence, Send send);
+
+private:
+
+	KmerError routeStretch(const char * bases, size_t length, Send & send);
+
+	size_t kmerWidth;
+	size_t minimizerWidth;
+	size_t workers;
+
+	std::vector<uint64_t> hashes; //of every minimizerWidth long substring of the stretch being routed
+	std::deque<size_t> minima;    //positions in hashes that can still be a window's minimum, smallest first
+
+};
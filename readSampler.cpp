@@ -0,0 +1,60 @@
+#include "readSampler.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+ReadSampler::ReadSampler(double fraction) :threshold(0), keepAll(fraction >= 1) {
+
+	if (!keepAll && fraction > 0)
+		threshold = (uint64_t)(fraction * 18446744073709551616.0);
+
+}
+
+bool ReadSampler::keep(const string & seqID) const {
+
+	if (keepAll)
+		return true;
+
+	//FNV-1a over the ID without its @ or >, so a read set is sampled the same as FASTQ and as FASTA,
+	//then a finalizer so IDs differing in the last characters spread out
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = seqID.size() && (seqID[0] == '@' || seqID[0] == '>') ? 1 : 0; i < seqID.size() && seqID[i] != ' ' && seqID[i] != '\t'; i++) {
+		hash ^= (unsigned char)seqID[i];
+		hash *= 1099511628211ull;
+	}
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+
+	return hash < threshold;
+
+}
+
+void ReadSampler::scaleCount(uint64_t count, double rate, uint64_t & estimate, uint64_t & low, uint64_t & high) {
+
+	double margin = 1.96 * sqrt(count * (1 - rate)) / rate;
+	double scaled = count / rate;
+
+	estimate = (uint64_t)llround(scaled);
+	low = (uint64_t)llround(max((double)count, scaled - margin));
+	high = (uint64_t)llround(scaled + margin);
+
+}
+
+void ReadSampler::appendScaledCount(string & out, uint64_t count, double rate) {
+
+	uint64_t estimate, low, high;
+	scaleCount(count, rate, estimate, low, high);
+
+	out += ",";
+	out += to_string(estimate);
+	out += ",";
+	out += to_string(low);
+	out += ",";
+	out += to_string(high);
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+//Deterministic read level subsampling for --sample-fraction. A read is kept when the hash of its ID, up to
+//the first space so both mates of a pair go the same way, falls in the sampled share of the hash range.
+//The same reads are picked on every run and by every process, whatever the order they're read in.
+class ReadSampler {
+
+public:
+
+	ReadSampler(double fraction);
+
+	bool keep(const std::string & seqID) const;
+
+	//Estimated count and 95% confidence interval of a kmer seen count times when a share rate of the
+	//input's reads was counted. Each occurrence is taken as sampled independently with probability rate,
+	//so the count is binomial; the interval is the normal approximation, never below what was seen.
+	static void scaleCount(uint64_t count, double rate, uint64_t & estimate, uint64_t & low, uint64_t & high);
+
+	//",estimate,low,high" for an output line
+	static void appendScaledCount(std::string & out, uint64_t count, double rate);
+
+private:
+
+	uint64_t threshold;
+	bool keepAll;
+
+};
@@ -0,0 +1,74 @@
+#include "scratchSpace.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace std;
+
+ScratchSpace::ScratchSpace(vector<string> _parents) :parents(_parents) {
+
+	if (parents.empty()) {
+		const char * tmp = getenv("TMPDIR");
+		parents.push_back(tmp && *tmp ? tmp : "/tmp");
+	}
+
+	directories.resize(parents.size());
+
+}
+
+KmerError ScratchSpace::getPath(size_t partition, string name, string & path) {
+
+	lock_guard<mutex> guard(lock);
+
+	size_t index = partition % parents.size();
+	string & directory = directories[index];
+
+	if (directory.empty()) {
+
+		const string & parent = parents[index];
+		string pattern = parent + (parent.back() == '/' ? "" : "/") + "kmerCounter.XXXXXX";
+		vector<char> created(pattern.begin(), pattern.end());
+		created.push_back(0);
+
+		if (mkdtemp(created.data()) == nullptr)
+			return KmerError(1, "Unable to create a scratch directory in " + parent + " : " + strerror(errno));
+
+		directory = created.data();
+
+	}
+
+	path = directory + "/" + name;
+	return KmerError();
+
+}
+
+vector<string> ScratchSpace::split(string list) {
+
+	vector<string> parts;
+	size_t start = 0;
+
+	while (start <= list.size()) {
+
+		size_t comma = list.find(',', start);
+		if (comma == string::npos)
+			comma = list.size();
+
+		if (comma > start)
+			parts.push_back(list.substr(start, comma - start));
+
+		start = comma + 1;
+
+	}
+
+	return parts;
+
+}
+
+ScratchSpace::~ScratchSpace() {
+
+	for (auto & i : directories)
+		if (!i.empty())
+			rmdir(i.c_str());
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "kmerError.h"
+#include <string>
+#include <vector>
+#include <mutex>
+
+//Private directories for a run's scratch databases. One is created in each of the given directories
+//with mkdtemp, so concurrent runs never share a file even in the same parent, and removed again when
+//the run is done. Partition i goes to directory i modulo their count, which spreads worker databases
+//over several drives. A directory is only created once a file is placed in it, so parents that no
+//partition lands in are left alone.
+class ScratchSpace {
+
+public:
+
+	//An empty list uses $TMPDIR, or /tmp without it
+	ScratchSpace(std::vector<std::string> parents);
+
+	//Path for a file of the given partition. Creates the partition's directory on first use, which is
+	//the only way this fails. Safe to call from several threads.
+	KmerError getPath(size_t partition, std::string name, std::string & path);
+
+	//"a,b,c" into its directories
+	static std::vector<std::string> split(std::string list);
+
+	//Removes the directories. Files in them have been removed by their owners unless the run failed.
+	~ScratchSpace();
+
+private:
+
+	std::vector<std::string> parents;
+	std::vector<std::string> directories; //empty until created
+	std::mutex lock;
+
+};
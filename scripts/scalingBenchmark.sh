@@ -0,0 +1,92 @@
+#!/bin/bash
+#
+# End-to-end scaling benchmark. Generates reproducible inputs with fastqGenerator and runs kmerCounter over
+# every combination of input size, kmer size, counter type and precision, recording wall time, peak RSS,
+# peak disk usage of the run directory and how many of the reported top kmers match the ground truth.
+#
+# Usage: scripts/scalingBenchmark.sh <buildDir> <workDir> [results.csv]
+#
+# The sweep can be narrowed through the environment, e.g.
+#   READS="1000000 10000000" KMERS="21 31" COUNTERS="0 1 2" PRECISIONS="0 3 4" TOP=25 scripts/scalingBenchmark.sh build /scratch/bench
+#
+# Peak RSS comes from GNU time (/usr/bin/time). Without it only the wall time is recorded.
+
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 <buildDir> <workDir> [results.csv]"
+	exit 1
+fi
+
+BUILD_DIR=$(cd "$1" && pwd)
+WORK_DIR=$2
+RESULTS=${3:-$WORK_DIR/scaling.csv}
+
+READS=${READS:-"1000000 10000000 100000000"}
+KMERS=${KMERS:-"21 31"}
+COUNTERS=${COUNTERS:-"0 1 2"}
+PRECISIONS=${PRECISIONS:-"0 3 4"}
+TOP=${TOP:-25}
+READ_LENGTH=${READ_LENGTH:-150}
+SEED=${SEED:-1}
+
+mkdir -p "$WORK_DIR"
+WORK_DIR=$(cd "$WORK_DIR" && pwd)
+
+echo "reads,k,counterType,precision,wallSeconds,peakRssKB,peakDiskBytes,topMatched,top" > "$RESULTS"
+
+for reads in $READS; do
+	for k in $KMERS; do
+
+		#Inputs are kept between runs, the generator is deterministic for a given seed
+		input="$WORK_DIR/synthetic_${reads}_${READ_LENGTH}_k${k}_s${SEED}.fastq"
+		if [ ! -f "$input" ] || [ ! -f "$input.truth" ]; then
+			echo "Generating $input"
+			"$BUILD_DIR/fastqGenerator" "$input" "$reads" --read-length "$READ_LENGTH" --kmer-size "$k" --top "$TOP" --seed "$SEED"
+		fi
+
+		for counter in $COUNTERS; do
+			for precision in $PRECISIONS; do
+
+				run="$WORK_DIR/run_${reads}_k${k}_c${counter}_p${precision}"
+				rm -rf "$run" && mkdir -p "$run"
+
+				#The database lives in the working directory, sample its size while the run is going
+				(
+					peak=0
+					while true; do
+						size=$(du -sb "$run" 2>/dev/null | cut -f1)
+						[ -n "$size" ] && [ "$size" -gt "$peak" ] && peak=$size && echo "$peak" > "$run.disk"
+						sleep 0.5
+					done
+				) &
+				sampler=$!
+
+				command=("$BUILD_DIR/kmerCounter" "$input" "$k" "$TOP" "$precision" "$counter" "$run/top.csv")
+				if [ -x /usr/bin/time ]; then
+					(cd "$run" && /usr/bin/time -f "%e %M" -o "$run.time" "${command[@]}" > "$run.log" 2>&1) || echo "Run failed, see $run.log"
+				else
+					start=$(date +%s.%N)
+					(cd "$run" && "${command[@]}" > "$run.log" 2>&1) || echo "Run failed, see $run.log"
+					awk -v s="$start" -v e="$(date +%s.%N)" 'BEGIN { printf "%.2f NA\n", e - s }' > "$run.time"
+				fi
+
+				kill $sampler 2>/dev/null || true
+				wait $sampler 2>/dev/null || true
+
+				read wall rss < "$run.time" || true
+				disk=$(cat "$run.disk" 2>/dev/null || echo 0)
+
+				#A reported kmer matches if it's in the truth file with the same count
+				matched=$(grep -cxFf "$input.truth" "$run/top.csv" 2>/dev/null || true)
+
+				echo "$reads,$k,$counter,$precision,$wall,$rss,$disk,${matched:-0},$TOP" | tee -a "$RESULTS"
+
+				rm -rf "$run" "$run.disk" "$run.time"
+
+			done
+		done
+	done
+done
+
+echo "Results written to $RESULTS"
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+//Streaming top N selection over (key, count) pairs from any source: a counter table, a database scan
+//or a merge. A min-heap holds the best N entries seen so far, with the weakest at the front, so each
+//entry costs at most O(log N) and memory stays at N entries however many are offered.
+//
+//Entries rank by count, highest first, and ties go to the smaller key. That is a total order, so the
+//winners and their order don't depend on the order entries arrive in (counter type, flush timing...).
+template <class K, typename C, class KeyLess = std::less<K>> class TopSelector {
+
+public:
+
+	typedef std::pair<K, C> Entry;
+
+	TopSelector(size_t _capacity) :capacity(_capacity) {
+		heap.reserve(capacity);
+	};
+
+	//a ranks ahead of b
+	static bool ranksBefore(const Entry & a, const Entry & b) {
+
+		if (a.second != b.second)
+			return a.second > b.second;
+
+		return KeyLess()(a.first, b.first);
+
+	};
+
+	//Whether an entry with this count could still get in. Lets a caller skip decoding keys that can't.
+	bool isCandidate(C count) const {
+		return capacity != 0 && (heap.size() < capacity || count >= heap.front().second);
+	};
+
+	void offer(const K & key, C count) {
+
+		if (!isCandidate(count))
+			return;
+
+		Entry entry(key, count);
+
+		if (heap.size() < capacity) {
+			heap.push_back(entry);
+			std::push_heap(heap.begin(), heap.end(), ranksBefore);
+			return;
+		}
+
+		if (!ranksBefore(entry, heap.front()))
+			return;
+
+		//replace the weakest winner
+		std::pop_heap(heap.begin(), heap.end(), ranksBefore);
+		heap.back() = entry;
+		std::push_heap(heap.begin(), heap.end(), ranksBefore);
+
+	};
+
+	//Moves the winners out, best first, and leaves the selector empty
+	void getSorted(std::vector<Entry> & entries) {
+
+		entries.clear();
+		entries.swap(heap);
+		std::sort_heap(entries.begin(), entries.end(), ranksBefore);
+		heap.reserve(capacity);
+
+	};
+
+	size_t size() const { return heap.size(); };
+
+private:
+
+	size_t capacity;
+	std::vector<Entry> heap; //std heap ordered by ranksBefore, so the front is the entry ranking last
+
+};
@@ -0,0 +1,225 @@
+#include "workerPool.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+bool PipeReader::getLine(string & line) {
+
+	line.clear();
+
+	while (true) {
+
+		char * from = buffer.data() + start;
+		char * newline = (char *)memchr(from, '\n', end - start);
+
+		if (newline) {
+			line.append(from, newline - from);
+			start += newline - from + 1;
+			return true;
+		}
+
+		line.append(from, end - start);
+		start = end = 0;
+
+		ssize_t got = read(fd, buffer.data(), buffer.size());
+		if (got < 0 && errno == EINTR)
+			continue;
+
+		if (got <= 0)
+			return !line.empty();
+
+		end = got;
+
+	}
+
+}
+
+WorkerPool::WorkerPool() {
+
+	//a worker that dies shows up as a write error and its exit status, not as a SIGPIPE
+	signal(SIGPIPE, SIG_IGN);
+
+}
+
+KmerError WorkerPool::start(size_t count, WorkerMain main) {
+
+	for (size_t i = 0; i < count; i++) {
+
+		int input[2], result[2];
+		if (pipe(input) != 0)
+			return KmerError(1, "Unable to create worker pipe");
+		if (pipe(result) != 0) {
+			close(input[0]);
+			close(input[1]);
+			return KmerError(1, "Unable to create worker pipe");
+		}
+
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			close(input[0]); close(input[1]); close(result[0]); close(result[1]);
+			return KmerError(1, "Unable to start worker " + to_string(i));
+		}
+
+		if (pid == 0) {
+
+			//only keep this worker's ends, or the other workers never see the end of their input
+			for (auto & w : workers) {
+				close(w.inputFd);
+				close(w.resultFd);
+			}
+			close(input[1]);
+			close(result[0]);
+
+			PipeReader reader(input[0]);
+			int status = main(i, reader, result[1]);
+			close(result[1]);
+
+			//skip the parent's atexit handlers and stream buffers
+			_exit(status);
+
+		}
+
+		close(input[0]);
+		close(result[1]);
+
+		Worker worker;
+		worker.pid = pid;
+		worker.inputFd = input[1];
+		worker.resultFd = result[0];
+		workers.push_back(worker);
+
+	}
+
+	return KmerError();
+
+}
+
+KmerError WorkerPool::writeAll(int fd, const char * data, size_t size) {
+
+	while (size) {
+
+		ssize_t written = write(fd, data, size);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return KmerError(1, string("Error writing to worker pipe : ") + strerror(errno));
+
+		data += written;
+		size -= written;
+
+	}
+
+	return KmerError();
+
+}
+
+KmerError WorkerPool::flushInput(size_t index) {
+
+	auto & worker = workers[index];
+
+	if (writeAll(worker.inputFd, worker.pending.data(), worker.pending.size()).isError())
+		return KmerError(1, "Worker " + to_string(index) + " stopped reading");
+
+	worker.pending.clear();
+	return KmerError();
+
+}
+
+KmerError WorkerPool::send(size_t index, const char * data, size_t size) {
+
+	workers[index].pending.append(data, size);
+
+	if (workers[index].pending.size() >= sendBytes)
+		return flushInput(index);
+
+	return KmerError();
+
+}
+
+KmerError WorkerPool::finishInput() {
+
+	KmerError err;
+
+	for (size_t i = 0; i < workers.size(); i++) {
+		if (!err.isError())
+			err = flushInput(i);
+		if (workers[i].inputFd >= 0)
+			close(workers[i].inputFd);
+		workers[i].inputFd = -1;
+	}
+
+	return err;
+
+}
+
+KmerError WorkerPool::collect(size_t index, string & result) {
+
+	result.clear();
+
+	char chunk[64 * 1024];
+	while (true) {
+
+		ssize_t got = read(workers[index].resultFd, chunk, sizeof(chunk));
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			return KmerError(1, "Error reading from worker " + to_string(index));
+		if (got == 0)
+			break;
+
+		result.append(chunk, got);
+
+	}
+
+	close(workers[index].resultFd);
+	workers[index].resultFd = -1;
+
+	return KmerError();
+
+}
+
+KmerError WorkerPool::wait() {
+
+	KmerError err;
+
+	for (size_t i = 0; i < workers.size(); i++) {
+
+		if (workers[i].pid <= 0)
+			continue;
+
+		int status = 0;
+		while (waitpid(workers[i].pid, &status, 0) < 0 && errno == EINTR);
+		workers[i].pid = 0;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			KmerError failed(1, "Worker " + to_string(i) + (WIFSIGNALED(status) ? " was killed by signal " + to_string(WTERMSIG(status)) : " failed"));
+			err |= failed;
+		}
+
+	}
+
+	return err;
+
+}
+
+WorkerPool::~WorkerPool() {
+
+	for (auto & w : workers) {
+
+		if (w.inputFd >= 0) close(w.inputFd);
+		if (w.resultFd >= 0) close(w.resultFd);
+
+		//only left over when the coordinator bailed out early
+		if (w.pid > 0) {
+			kill(w.pid, SIGTERM);
+			waitpid(w.pid, nullptr, 0);
+		}
+
+	}
+
+}
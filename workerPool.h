@@ -0,0 +1,76 @@
+#pragma once
+
+#include "kmerError.h"
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+//Line oriented reader over a pipe, for workers reading the reads the coordinator sends them
+class PipeReader {
+
+public:
+
+	PipeReader(int _fd) :fd(_fd), start(0), end(0), buffer(1024 * 1024) {};
+
+	//False once the other end is closed and every line has been returned
+	bool getLine(std::string & line);
+
+private:
+
+	int fd;
+	size_t start;
+	size_t end;
+	std::vector<char> buffer;
+
+};
+
+//Worker processes for --workers. The coordinator forks them before anything else starts, streams each
+//one the parts of the reads holding its kmers over a pipe (see ReadRouter), then collects what each one
+//writes back on its result pipe. Each worker owns a partition of the kmers, so it has its own tables,
+//allocator, address space and database, and their top kmers never overlap.
+class WorkerPool {
+
+public:
+
+	//Runs in the child. The return value becomes the worker's exit status.
+	typedef std::function<int(size_t index, PipeReader & input, int resultFd)> WorkerMain;
+
+	WorkerPool();
+
+	KmerError start(size_t count, WorkerMain main);
+
+	//Buffers data for one worker, sending it once enough has piled up
+	KmerError send(size_t index, const char * data, size_t size);
+
+	//Sends what's left and closes the workers' input, which tells them the reads are done
+	KmerError finishInput();
+
+	//Everything the worker wrote to its result pipe, up to its exit
+	KmerError collect(size_t index, std::string & result);
+
+	//Reaps the workers, failing if any of them didn't exit cleanly
+	KmerError wait();
+
+	size_t size() { return workers.size(); };
+
+	static KmerError writeAll(int fd, const char * data, size_t size);
+
+	~WorkerPool();
+
+private:
+
+	KmerError flushInput(size_t index);
+
+	struct Worker {
+		pid_t pid;
+		int inputFd;
+		int resultFd;
+		std::string pending;
+	};
+
+	std::vector<Worker> workers;
+
+	static const size_t sendBytes = 1024 * 1024;
+
+};